@@ -2,11 +2,18 @@
 
 #include <algorithm>
 #include <cassert>
+#include <cstring>
+#include <functional>
 #include <iostream>
 #include <memory>
+#include <new>
 #include <string>
+#include <vector>
 
+#include "adaptive_radix_tree_memory.hpp"
 #include "adaptive_radix_tree_node.hpp"
+#include "adaptive_radix_tree_stats.hpp"
+#include "adaptive_radix_tree_suffix_table.hpp"
 
 /// Defines how to iterate over tuples.
 /// Briefly; it takes index vector and a starting point as input
@@ -18,6 +25,13 @@
 class CIndexIterator final: public std::iterator<std::input_iterator_tag, uint32_t>
 {
 public:
+  /// Creates an iterator of an empty range.
+  CIndexIterator()
+      : indexes_( nullptr ),
+        index_( CArtNode::LAST_INDEX_IDENTIFIER )
+  {
+  }
+
   explicit CIndexIterator( const std::vector<uint32_t>& indexes, uint32_t start )
       : indexes_( &indexes ),
         index_(start )
@@ -39,7 +53,7 @@ public:
 
   bool operator==( CIndexIterator const & o ) const
   {
-    assert( this->indexes_ == o.indexes_ );
+    assert( this->indexes_ == o.indexes_ || !this->indexes_ || !o.indexes_ );
     return this->index_ == o.index_;
   }
 
@@ -77,6 +91,30 @@ public:
   virtual void HandleTuple( const std::string& key, CIndexIterator begin, CIndexIterator end ) = 0;
 };
 
+/// Defines actions for keys existing in two ARTs, see CAdaptiveRadixTree::MergeJoin.
+class CJoinActionBase
+{
+public:
+  virtual ~CJoinActionBase() = default;
+
+  /// This function is called for each key existing in both trees and provides:
+  /// - key
+  /// - row indexes of key in left tree
+  /// - row indexes of key in right tree.
+  virtual void HandleTuple( const std::string& key, CIndexIterator left_begin, CIndexIterator left_end,
+                            CIndexIterator right_begin, CIndexIterator right_end ) = 0;
+};
+
+/// Defines actions for keys given as views, see CAdaptiveRadixTree::TraverseKeys.
+class CKeyActionBase
+{
+public:
+  virtual ~CKeyActionBase() = default;
+
+  /// key points to a buffer of the traversal which is overwritten by following keys.
+  virtual void HandleKey( const char* key, size_t key_length, CIndexIterator begin, CIndexIterator end ) = 0;
+};
+
 /// Defines actions for tuples of ART nodes.
 class CIndexActionBase
 {
@@ -86,6 +124,219 @@ public:
   virtual void HandleTuple( CIndexIterator begin, CIndexIterator end ) = 0;
 };
 
+/// Destination of scans (see CAdaptiveRadixTree::ScanPoint), which write matching rows either as bits of a
+/// caller provided bitmap or appended to a selection vector, walking each row chain once without calling an action.
+class CRowSelection
+{
+public:
+  enum Mode
+  {
+    /// Each scan first clears the bitmap, or the selection vector.
+    Replace,
+    /// Scans add to what is selected already, e.g. to scan each value of an IN list into one selection.
+    /// A selection vector then holds a row twice if it is matched by two scans.
+    Or,
+  };
+
+  /// bitmap must hold ( row_count + 63 ) / 64 words, row_count being at least GetIndexVectorLength() of the tree.
+  /// Row i is bit i % 64 of word i / 64.
+  CRowSelection( uint64_t* bitmap, size_t row_count, Mode mode = Replace )
+      : bitmap_( bitmap ),
+        word_count_( ( row_count + 63 ) / 64 ),
+        rows_( nullptr ),
+        mode_( mode )
+  {
+  }
+
+  /// Rows are appended in chain order, which is not row order.
+  explicit CRowSelection( std::vector<uint32_t>& rows, Mode mode = Replace )
+      : bitmap_( nullptr ),
+        word_count_( 0 ),
+        rows_( &rows ),
+        mode_( mode )
+  {
+  }
+
+  /// Called by a scan before adding any row.
+  void Begin()
+  {
+    if ( mode_ == Replace )
+    {
+      if ( bitmap_ )
+      {
+        memset( bitmap_, 0, word_count_ * sizeof( uint64_t ) );
+      }
+      else
+      {
+        rows_->clear();
+      }
+    }
+  }
+
+  Mode GetMode() const
+  {
+    return mode_;
+  }
+
+  /// Lets a scan over several trees clear the selection for the first tree only.
+  void SetMode( Mode mode )
+  {
+    mode_ = mode;
+  }
+
+  /// Adds rows of [begin, end), returns their number.
+  size_t Add( CIndexIterator begin, CIndexIterator end )
+  {
+    size_t count = 0;
+    if ( bitmap_ )
+    {
+      for ( ; begin != end; ++begin, ++count )
+      {
+        const uint32_t row = *begin;
+        assert( row / 64 < word_count_ );
+        bitmap_[row / 64] |= uint64_t( 1 ) << ( row % 64 );
+      }
+    }
+    else
+    {
+      for ( ; begin != end; ++begin, ++count )
+      {
+        rows_->push_back( *begin );
+      }
+    }
+    return count;
+  }
+
+private:
+  uint64_t* bitmap_;
+  size_t word_count_;
+  std::vector<uint32_t>* rows_;
+  Mode mode_;
+};
+
+namespace detail
+{
+/// Adds rows of traversed keys to a CRowSelection, for scans built on traversals.
+class CSelectAction final : public CActionBase, public CIndexActionBase
+{
+public:
+  explicit CSelectAction( CRowSelection & selection )
+      : selection_( selection )
+  {
+  }
+
+  void HandleNode( const CArtNode*, const std::string&, uint32_t ) override
+  {
+  }
+
+  void HandleTuple( const std::string&, CIndexIterator begin, CIndexIterator end ) override
+  {
+    count_ += selection_.Add( begin, end );
+  }
+
+  void HandleTuple( CIndexIterator begin, CIndexIterator end ) override
+  {
+    count_ += selection_.Add( begin, end );
+  }
+
+  size_t GetCount() const
+  {
+    return count_;
+  }
+
+private:
+  CRowSelection & selection_;
+  size_t count_ = 0;
+};
+
+/// Tracks how a key built byte by byte during a traversal compares to bounds of an inclusive key range.
+/// Copied at each level, so that siblings start from the state of their parent.
+class CKeyRangeCursor
+{
+public:
+  CKeyRangeCursor( const char* low, size_t low_length, const char* high, size_t high_length )
+      : low_( low ),
+        low_length_( low_length ),
+        high_( high ),
+        high_length_( high_length )
+  {
+  }
+
+  /// Called after key[from, to) is built, returns false if no key starting with key[0, to) is in range.
+  bool Advance( const char* key, size_t from, size_t to )
+  {
+    for ( size_t i = from; i < to && !( above_low_ && below_high_ ); ++i )
+    {
+      const uint8_t c = static_cast<uint8_t>( key[i] );
+      if ( !above_low_ )
+      {
+        if ( i >= low_length_ || c > static_cast<uint8_t>( low_[i] ) )
+        {
+          above_low_ = true;
+        }
+        else if ( c < static_cast<uint8_t>( low_[i] ) )
+        {
+          return false;
+        }
+      }
+      if ( !below_high_ )
+      {
+        if ( i >= high_length_ || c > static_cast<uint8_t>( high_[i] ) )
+        {
+          return false;
+        }
+        below_high_ = c < static_cast<uint8_t>( high_[i] );
+      }
+    }
+    return true;
+  }
+
+  /// Sets [first, last] to the bytes which may follow key[0, length) in range, given that Advance succeeded
+  /// for all of it; returns false if no longer key is in range.
+  bool ChildBounds( size_t length, uint8_t& first, uint8_t& last ) const
+  {
+    first = !above_low_ && length < low_length_ ? static_cast<uint8_t>( low_[length] ) : 0;
+    if ( !below_high_ && length >= high_length_ )
+    {
+      return false;
+    }
+    last = below_high_ ? 255 : static_cast<uint8_t>( high_[length] );
+    return true;
+  }
+
+  /// Returns whether key[0, length) is in range, given that Advance succeeded for all of it.
+  bool Contains( size_t length ) const
+  {
+    // otherwise key is a prefix of low, and of high if it isn't below it.
+    return above_low_ || length == low_length_;
+  }
+
+private:
+  const char* low_;
+  size_t low_length_;
+  const char* high_;
+  size_t high_length_;
+  bool above_low_ = false;
+  bool below_high_ = false;
+};
+}
+
+class CSuccinctRadixTree;
+
+/// Node pool and suffix table shared by many small trees, see CAdaptiveRadixTree( uint32_t, std::shared_ptr<CArtArena> ).
+/// Trees sharing an arena must not be modified concurrently, since they append to the same suffix table.
+struct CArtArena
+{
+  explicit CArtArena( const CArtMemoryPolicy & memory_policy = CArtMemoryPolicy() )
+      : node_pool_( std::make_shared<CArtNodePool>( memory_policy ) ),
+        suffix_table_( std::make_shared<CArtSuffixTable>() )
+  {
+  }
+
+  std::shared_ptr<CArtNodePool> node_pool_;
+  std::shared_ptr<CArtSuffixTable> suffix_table_;
+};
+
 //todo(demiroz): document!
 //todo(demiroz): add support for int64_t!
 
@@ -106,6 +357,19 @@ public:
   {
   }
 
+  /// Places index vector and nodes as given policy says, e.g. on huge pages interleaved over NUMA nodes.
+  /// Nodes are allocated from a CArtNodePool of the tree; trees created by Split use the same policy.
+  CAdaptiveRadixTree( uint32_t max_index_count, const CArtMemoryPolicy & memory_policy );
+
+  CAdaptiveRadixTree( std::shared_ptr<std::vector<uint32_t>> indexes, const CArtMemoryPolicy & memory_policy );
+
+  /// Creates a small tree, for tables split into many partitions with few distinct values each.
+  /// Root starts as a CArtNode4 and grows on demand instead of being a CArtNode256, and if an arena is given,
+  /// nodes are allocated from its pool and prefixes are appended to its suffix table, so small trees don't
+  /// each keep a partially used suffix buffer. Reset and Split keep the mode; trees created by Split have their
+  /// own node pool with the arena's policy and their own suffix table, so they can be filled concurrently.
+  CAdaptiveRadixTree( uint32_t max_index_count, std::shared_ptr<CArtArena> arena );
+
   CAdaptiveRadixTree( const CAdaptiveRadixTree & other ) = delete;
   CAdaptiveRadixTree& operator=( const CAdaptiveRadixTree& ) = delete;
 
@@ -125,14 +389,44 @@ public:
     swap( first.max_string_length_, second.max_string_length_ );
     swap( first.unique_string_count_, second.unique_string_count_ );
     swap( first.total_string_length_, second.total_string_length_ );
+    swap( first.node_bytes_, second.node_bytes_ );
     swap( first.suffix_table_, second.suffix_table_ );
     swap( first.indexes_, second.indexes_ );
+    swap( first.node_pools_, second.node_pools_ );
+    swap( first.node_pool_, second.node_pool_ );
+    swap( first.small_, second.small_ );
+    swap( first.tracking_, second.tracking_ );
+    ART_STATS( swap( first.stats_, second.stats_ ) );
   }
 
   void AddEntry( const char* key, size_t key_length, uint32_t value );
 
+  /// Enables DeleteRow and UpdateRow in O(key length) by keeping, for each row, the previous row of its chain,
+  /// its key length and, for chain heads, the node holding the chain; 16 bytes per row. Tracking is built
+  /// from current contents and maintained by later insertions. Since rows are unlinked in place, a tracked
+  /// tree must not be snapshotted, split or joined.
+  void EnableRowTracking();
+
+  bool IsRowTrackingEnabled() const
+  {
+    return tracking_ != nullptr;
+  }
+
+  /// Removes row from its key, or from NULL strings. Returns false if row is not in the tree.
+  /// A key losing its last row is no longer visited, its node is kept for later insertions until Optimize.
+  bool DeleteRow( uint32_t row );
+
+  /// Moves row to given key, inserting it if it is not in the tree.
+  void UpdateRow( uint32_t row, const char* key, size_t key_length );
+
+  /// Adds count entries, i-th one being keys[i] with key_lengths[i] bytes and value values[i].
+  /// Each insertion resumes from the deepest node the previous key visited on their shared prefix instead of
+  /// starting from root, so inputs with long shared prefixes (sorted or clustered) insert faster.
+  void AddEntries( const char* const* keys, const size_t* key_lengths, const uint32_t* values, size_t count );
+
   void Traverse( CActionBase & action ) const
   {
+    ART_STATS( ++Stats().traverse_count_ );
     if ( root_ )
     {
       std::string key;
@@ -142,18 +436,135 @@ public:
 
   void TraverseIndexes( CIndexActionBase & action ) const
   {
+    ART_STATS( ++Stats().traverse_count_ );
     if ( root_ )
     {
       TraverseIndexRecursive( root_, action );
     }
   }
 
+  /// Traverses the tree on given number of threads (hardware concurrency if 0) like Traverse does.
+  /// Upper nodes are expanded into independent subtrees, which are handed out to per thread queues, and idle
+  /// threads steal subtrees from the others. Each thread has its own key buffer.
+  ///
+  /// Unless ordered, an action is created per thread and actions are returned in no particular order.
+  /// If ordered, an action is created per subtree and actions are returned in key order, each of them having
+  /// seen a contiguous range of keys in key order, so results can be combined in key order.
+  /// Actions are created on the calling thread. Tuples of the NULL string are not visited, as in Traverse.
+  std::vector<std::unique_ptr<CActionBase>> TraverseParallel(
+      const std::function<std::unique_ptr<CActionBase>()> & action_factory, unsigned threads,
+      bool ordered = false ) const;
+
+  /// Calls handler( const char* key, size_t key_length, CIndexIterator begin, CIndexIterator end ) for each key
+  /// in key order. Keys are rebuilt in a single buffer of GetMaxStringLength() bytes, where each node writes
+  /// its prefix once at its depth and children overwrite what follows, so nothing is allocated or copied
+  /// per key. key is only valid during the call. Handler is a template argument, so it can be inlined.
+  template <typename Handler>
+  void ForEachKey( Handler && handler ) const
+  {
+    ART_STATS( ++Stats().traverse_count_ );
+    if ( root_ )
+    {
+      std::unique_ptr<char[]> key( new char[max_string_length_ + 1] );
+      ForEachKeyRecursive( root_, key.get(), 0, handler );
+    }
+  }
+
+  /// Same as ForEachKey for handlers which aren't known at compile time.
+  void TraverseKeys( CKeyActionBase & action ) const
+  {
+    ForEachKey( [&action]( const char* key, size_t key_length, CIndexIterator begin, CIndexIterator end ) {
+      action.HandleKey( key, key_length, begin, end );
+    } );
+  }
+
+  /// Calls action.HandleTuple for each key matching given SQL LIKE pattern, in key order.
+  /// any_string matches any sequence of characters and any_char matches exactly one; pass '*' and '?'
+  /// for glob patterns. Pattern is run over the tree, so that literal parts of it only descend into
+  /// the children they match and subtrees are skipped as soon as no match is possible.
+  /// HandleNode is not called.
+  void MatchPattern( const char* pattern, size_t pattern_length, CActionBase & action, char any_string = '%',
+                     char any_char = '_' ) const;
+
+  /// Calls action.HandleTuple for each key within max_distance edits (insertion, deletion or substitution
+  /// of a character) of query, in key order. Edit distance rows are computed once per tree level and shared
+  /// by all keys below it, and a subtree is skipped as soon as every entry of the row exceeds max_distance.
+  /// HandleNode is not called.
+  void FuzzySearch( const char* query, size_t query_length, uint32_t max_distance, CActionBase & action ) const;
+
+  /// Looks up key and sets [begin, end) to its rows. Returns false if key is not stored.
+  bool Find( const char* key, size_t key_length, CIndexIterator & begin, CIndexIterator & end ) const;
+
+  /// Calls action.HandleTuple in key order for each key in [low, high]; subtrees outside the range are skipped.
+  /// HandleNode is not called.
+  void TraverseRange( const char* low, size_t low_length, const char* high, size_t high_length,
+                      CActionBase & action ) const;
+
+  /// Scans select rows of the key, of keys in [low, high], of keys starting with prefix or NULL strings
+  /// into selection, see CRowSelection. Return number of rows added.
+  size_t ScanPoint( const char* key, size_t key_length, CRowSelection & selection ) const;
+  size_t ScanRange( const char* low, size_t low_length, const char* high, size_t high_length,
+                    CRowSelection & selection ) const;
+  size_t ScanPrefix( const char* prefix, size_t prefix_length, CRowSelection & selection ) const;
+  size_t ScanNull( CRowSelection & selection ) const;
+
+  /// Finds the longest stored key which is a prefix of given key with a single descent.
+  /// Returns its length and its rows as [begin, end), or -1 if no stored key is a prefix of given key.
+  int64_t LongestPrefixMatch( const char* key, size_t key_length, CIndexIterator & begin,
+                              CIndexIterator & end ) const;
+
+  /// Calls action.HandleTuple for each stored key which is a prefix of given key, shortest first.
+  /// HandleNode is not called.
+  void PrefixMatches( const char* key, size_t key_length, CActionBase & action ) const;
+
+  /// Calls action.HandleTuple in key order for each key existing both in this and other tree, with rows of
+  /// both sides. Trees are walked together, comparing prefixes of their nodes directly, so subtrees
+  /// existing only on one side are skipped. Trees don't need to share an index vector.
+  void MergeJoin( const CAdaptiveRadixTree & other, CJoinActionBase & action ) const;
+
+  /// Calls action.HandleTuple in key order for each key of this tree which exists in other tree, with rows of this
+  /// tree. HandleNode is not called.
+  void Intersect( const CAdaptiveRadixTree & other, CActionBase & action ) const;
+
+  /// Calls action.HandleTuple in key order for each key of this tree which does not exist in other tree.
+  /// HandleNode is not called.
+  void Difference( const CAdaptiveRadixTree & other, CActionBase & action ) const;
+
   void Reset();
 
   std::unique_ptr<CAdaptiveRadixTree> Split();
 
+  /// Moves the keys of this tree into k trees created by Split, each holding a contiguous key range with about
+  /// the same number of keys; the first one also gets the NULL strings and this tree is left empty.
+  /// Subtrees lying in a single range are moved, their prefixes being copied into the suffix table of their new
+  /// tree in key order, and only nodes on the paths between ranges are cut. Rows of keys merged at such cuts are
+  /// relinked, so snapshots taken before may see them.
+  std::vector<std::unique_ptr<CAdaptiveRadixTree>> SplitByRange( size_t k );
+
+  /// Rewrites the tree for read heavy phases, e.g. after ingestion with many Joins: nodes are copied in depth
+  /// first order into a new CArtNodePool, so subtrees are contiguous in memory, each as the smallest node
+  /// type holding its children, and prefixes are copied into a new suffix table in the same order. Subtrees
+  /// without keys, left by DeleteRow, are dropped. Nodes are allocated from that pool afterwards, with the
+  /// memory policy of the previous pool if any. Snapshots taken before keep the old nodes.
+  void Optimize();
+
+  /// Converts tree to a read-only CSuccinctRadixTree sharing its index vector, for partitions which won't
+  /// change anymore. Tree itself is left intact.
+  std::unique_ptr<CSuccinctRadixTree> FreezeSuccinct() const;
+
+  /// Returns an immutable view of the tree as of now, which is not affected by later insertions.
+  /// Nodes are shared with the snapshot and following AddEntry/Join calls copy only the nodes on
+  /// the paths they modify. Since row chains are only prepended to, snapshot keeps reading
+  /// the rows it had through the shared index vector while new rows are linked in front of them.
+  ///
+  /// Snapshot can be read from other threads while insertions continue on this tree, but Snapshot
+  /// itself has to be called from the writing thread. Joining this tree into another one relinks
+  /// its rows, so snapshots of a tree have to be released before it is passed to Join.
+  std::shared_ptr<const CAdaptiveRadixTree> Snapshot() const;
+
   void Join( CAdaptiveRadixTree & other )
   {
+    assert( !tracking_ && !other.tracking_ );
     // Merge null string positions first.
     CIndexIterator it = other.GetNullStringBegin(), end = other.GetNullStringEnd();
     while ( it != end )
@@ -163,12 +574,28 @@ public:
       AddNullString( value );
     }
 
-    Merge( &root_, &(other.root_), other.suffix_table_ );
+    // nodes of other tree are moved here, so are their pools.
+    for ( auto & pool : other.node_pools_ )
+    {
+      if ( std::find( node_pools_.begin(), node_pools_.end(), pool ) == node_pools_.end() )
+      {
+        node_pools_.push_back( pool );
+      }
+    }
+
+    Merge( &root_, &( other.root_ ), *other.suffix_table_ );
 
     total_string_length_ += other.GetTotalStringLength();
     max_string_length_ = std::max( max_string_length_, other.GetMaxStringLength() );
   }
 
+  /// Joins all others into this tree, as calling Join for each of them would; others are left empty and have
+  /// to share the index vector of this tree. All trees are walked together level by level, so each node is
+  /// visited once and each prefix is appended to the suffix table once, instead of being merged again into
+  /// a growing tree by each Join. As for Join, rows of others are relinked, so only snapshots of this tree are
+  /// left intact.
+  void JoinMany( const std::vector<CAdaptiveRadixTree *> & others );
+
   /// Handle NULL string separately.
   void AddNullString( uint32_t value )
   {
@@ -177,6 +604,11 @@ public:
     indexes_->operator[]( value ) = null_string_;
     null_string_ = value;
     ++null_string_count_;
+    ART_STATS( ++Stats().null_insert_count_ );
+    if ( tracking_ )
+    {
+      TrackRow( value, nullptr, CRowTracking::NULL_ROW );
+    }
   }
 
   void Reserve( int64_t new_capacity )
@@ -187,14 +619,18 @@ public:
   void Resize( int64_t new_size )
   {
     indexes_->resize( new_size );
+    if ( tracking_ )
+    {
+      tracking_->Resize( new_size );
+    }
   }
 
-  CIndexIterator GetNullStringBegin()
+  CIndexIterator GetNullStringBegin() const
   {
     return CIndexIterator( *indexes_, null_string_ );
   }
 
-  CIndexIterator GetNullStringEnd()
+  CIndexIterator GetNullStringEnd() const
   {
     return CIndexIterator( *indexes_, CArtNode::LAST_INDEX_IDENTIFIER );
   }
@@ -231,22 +667,181 @@ public:
     return total_string_length_;
   }
 
+  /// Approximate bytes used by the tree: nodes allocated since construction or Reset, including the ones
+  /// replaced when a node grew, and suffix table. The index vector, which may be shared with other trees, and
+  /// nodes taken over from other trees by Join aren't included.
+  size_t GetMemoryUsage() const
+  {
+    return node_bytes_ + suffix_table_->capacity();
+  }
+
+  /// Returns pool new nodes are allocated from, or nullptr if they are allocated with new.
+  const CArtNodePool * GetNodePool() const
+  {
+    return node_pool_;
+  }
+
+  /// Returns hot path counters, which are all zero unless ART_ENABLE_STATS is defined.
+  CArtStats GetStats() const
+  {
+#ifdef ART_ENABLE_STATS
+    return stats_;
+#else
+    return CArtStats();
+#endif
+  }
+
 private:
+  friend class CSuccinctRadixTree;
+
+  /// Takes over a reference of given root, used by Snapshot.
+  CAdaptiveRadixTree( CArtNode * root, std::shared_ptr<std::vector<uint32_t>> indexes )
+      : root_( root ),
+        indexes_( indexes )
+  {
+  }
+
   void TraverseRecursive(CArtNode * iNode, CActionBase & action, std::string& key, int level ) const;
 
   void TraverseIndexRecursive(CArtNode * iNode, CIndexActionBase & action ) const;
 
+  template <typename Handler>
+  void ForEachKeyRecursive( CArtNode * node, char* key, size_t key_length, Handler & handler ) const;
+
+  /// Calls function( node, key length ) for each node with end of string on the path of key.
+  template <typename Function>
+  void DescendPrefixes( const char* key, size_t key_length, Function function ) const;
+
+  /// Returns the topmost node whose subtree holds exactly the keys starting with prefix, or nullptr.
+  CArtNode * FindPrefixNode( const char* prefix, size_t prefix_length ) const;
+
+  /// Calls action.HandleTuple for each key in subtree of node, starting from given offset of node prefix.
+  void EmitRecursive( CArtNode * node, uint32_t offset, std::string & key, CActionBase & action ) const;
+
+  /// Walks this tree from left node and other tree from right node together; nodes are entered at given
+  /// offsets of their prefixes. Calls both( key, left, right ) for keys existing in both and, if left_only
+  /// is given, emits keys existing only in this tree to it.
+  template <typename Function>
+  void WalkTogether( CArtNode * left, uint32_t left_offset, const CAdaptiveRadixTree & other, CArtNode * right,
+                     uint32_t right_offset, std::string & key, Function & both, CActionBase * left_only ) const;
+
+  class CPatternAutomaton;
+
+  /// State of SplitByRange.
+  struct CRangeSplit;
+
+  /// Computes edit distance row of next level from previous one, returns minimum of the row.
+  static uint32_t NextDistanceRow( const uint32_t * previous, uint32_t * next, const char* query, size_t query_length,
+                                   char c );
+
+  void RangeRecursive( CArtNode * node, detail::CKeyRangeCursor cursor, std::string & key, CActionBase & action ) const;
+
+  void FuzzyRecursive( CArtNode * node, const char* query, size_t query_length, uint32_t max_distance,
+                       uint32_t * rows, std::string & key, CActionBase & action ) const;
+
+  void MatchRecursive( CArtNode * node, const CPatternAutomaton & automaton, uint64_t * states, bool everything,
+                       std::string & key, CActionBase & action ) const;
+
+  /// Inserts key starting from node at node_base, whose prefix starts at given depth of key.
+  /// Records visited node slots and depths to path if it is given.
+  void Insert( const char* key, size_t key_length, uint32_t value, CArtNode ** node_base, size_t depth,
+               std::vector<std::pair<CArtNode **, size_t>> * path );
+
   CArtNode ** FindChild(CArtNode * node, uint8_t c ) const;
 
   CArtNode ** InsertInNode(CArtNode ** base_node, uint8_t c, CArtNode * child_node );
 
   void InsertValue(CArtNode ** node_base, CArtNode * node, uint32_t value );
 
-  void MovePrefix(CArtNode * input_node, std::string& other_suffix_table );
+  /// Appends bytes to suffix table and returns their position.
+  uint32_t AppendSuffix( const char* bytes, size_t length );
+
+  /// Creates a node in node pool of the tree if it has one, otherwise on heap.
+  template <typename Node>
+  Node * NewNode() const
+  {
+    node_bytes_ += sizeof( Node );
+    if ( !node_pool_ )
+    {
+      return new Node();
+    }
+    Node * node = new ( node_pool_->Allocate( sizeof( Node ), Node::TYPE ) ) Node();
+    node->pooled_ = true;
+    return node;
+  }
+
+  /// Creates an empty root, a CArtNode4 for small trees.
+  CArtNode * NewRoot() const
+  {
+    return small_ ? static_cast<CArtNode *>( NewNode<CArtNode4>() ) : NewNode<CArtNode256>();
+  }
+
+  /// Per row links of EnableRowTracking.
+  struct CRowTracking
+  {
+    static const uint32_t ABSENT = CArtNode::LAST_INDEX_IDENTIFIER;  //< key length of rows not in tree.
+    static const uint32_t NULL_ROW = ABSENT - 1;                       //< key length of NULL strings.
+
+    void Resize( size_t size )
+    {
+      previous_.resize( size, uint32_t( CArtNode::LAST_INDEX_IDENTIFIER ) );
+      key_lengths_.resize( size, uint32_t( ABSENT ) );
+      leaves_.resize( size, nullptr );
+    }
+
+    std::vector<uint32_t> previous_;  //< previous row in chain, LAST_INDEX_IDENTIFIER for chain heads.
+    std::vector<uint32_t> key_lengths_;
+    std::vector<CArtNode *> leaves_;  //< node holding the chain for chain heads, nullptr for NULL strings.
+  };
+
+  /// Records row which was just linked as head of the chain of leaf (nullptr for NULL strings).
+  void TrackRow( uint32_t row, CArtNode * leaf, uint32_t key_length );
+
+  /// Points head of chain of node to it after node is replaced with a copy.
+  void TrackLeaf( CArtNode * node ) const
+  {
+    if ( tracking_ && node->end_of_string_ && node->value_ != CArtNode::LAST_INDEX_IDENTIFIER )
+    {
+      tracking_->leaves_[node->value_] = node;
+    }
+  }
+
+  CArtNode * CopyNode( const CArtNode * node ) const;
+
+  /// Copies subtree of node as Optimize does, prefixes are read from given table. Returns nullptr if the
+  /// subtree holds no key.
+  CArtNode * OptimizedCopy( CArtNode * node, const CArtSuffixTable & old_suffix_table );
+
+  /// Replaces node at given base with a private copy if it is shared with a snapshot.
+  CArtNode * MakeUnique( CArtNode ** node_base ) const;
+
+  void MovePrefix(CArtNode ** input_node_base, const CArtSuffixTable& other_suffix_table );
+
+  void Merge(CArtNode ** left, CArtNode ** right, const CArtSuffixTable& right_suffix_table_ );
+
+  void MergeChildNodes(CArtNode ** left, CArtNode * right, const CArtSuffixTable& right_suffix_table_ );
+
+  /// Position in a node of one of the trees joined by JoinMany.
+  struct CJoinCursor
+  {
+    CArtNode ** node_base_;
+    const CArtSuffixTable * suffix_table_;
+    uint32_t offset_;  //< bytes of node prefix already matched.
+  };
+
+  /// Builds the node joining subtrees of all cursors, which are at the same key. Subtrees are taken over:
+  /// nodes are either moved into the result or deleted, and their bases are cleared.
+  CArtNode * JoinRecursive( const std::vector<CJoinCursor> & cursors );
 
-  void Merge(CArtNode ** left, CArtNode ** right, std::string& right_suffix_table_ );
+  /// Counts keys of each node of the subtree into split, returns those of node.
+  size_t CountKeys( CArtNode * node, CRangeSplit & split ) const;
 
-  void MergeChildNodes(CArtNode ** left, CArtNode * right, std::string& right_suffix_table_ );
+  /// Moves subtree of node, whose key starts with path, to the ranges of split; before is the number of keys
+  /// before it and is advanced past it.
+  void SplitRecursive( CArtNode ** node_base, std::string & path, size_t & before, CRangeSplit & split );
+
+  /// Moves subtree of node, whose key starts with path, into part and clears its base.
+  void MoveSubtree( CArtNode ** node_base, const std::string & path, CAdaptiveRadixTree & part );
 
 private:
   CArtNode * root_; // todo(demiroz): unique_ptr?
@@ -255,6 +850,45 @@ private:
   size_t max_string_length_ = 0;
   size_t unique_string_count_ = 0;
   size_t total_string_length_ = 0;
-  std::string suffix_table_;
+  mutable size_t node_bytes_ = 0;  //< allocated by NewNode, see GetMemoryUsage.
+  std::shared_ptr<CArtSuffixTable> suffix_table_ = std::make_shared<CArtSuffixTable>();  //< may be shared, see CArtArena.
   std::shared_ptr<std::vector<uint32_t>> indexes_;
+  std::vector<std::shared_ptr<CArtNodePool>> node_pools_;  //< pools owning memory of nodes of this tree.
+  CArtNodePool * node_pool_ = nullptr;                       //< pool for new nodes, one of node_pools_.
+  bool small_ = false;                                       //< root starts as CArtNode4.
+  std::unique_ptr<CRowTracking> tracking_;                   //< set by EnableRowTracking.
+#ifdef ART_ENABLE_STATS
+  mutable CArtStats stats_;
+  static thread_local CArtStats * worker_stats_;  //< set while a TraverseParallel worker runs on the thread.
+
+  /// Counters to increment on calling thread, see TraverseParallel.
+  CArtStats & Stats() const
+  {
+    return worker_stats_ ? *worker_stats_ : stats_;
+  }
+#endif
 };
+
+template <typename Handler>
+void CAdaptiveRadixTree::ForEachKeyRecursive( CArtNode * node, char* key, size_t key_length, Handler & handler ) const
+{
+  ART_STATS( ++Stats().traversed_node_count_ );
+  if ( node->prefix_length_ )
+  {
+    assert( key_length + node->prefix_length_ <= max_string_length_ );
+    memcpy( key + key_length, suffix_table_->data() + node->prefix_position_, node->prefix_length_ );
+    key_length += node->prefix_length_;
+  }
+
+  if ( node->end_of_string_ )
+  {
+    handler( const_cast<const char*>( key ), key_length, CIndexIterator( *indexes_, node->value_ ),
+             CIndexIterator( *indexes_, CArtNode::LAST_INDEX_IDENTIFIER ) );
+  }
+
+  detail::Helper::ForEachChild( node, [&]( uint8_t c, CArtNode *& child ) {
+    assert( key_length < max_string_length_ );
+    key[key_length] = static_cast<char>( c );
+    ForEachKeyRecursive( child, key, key_length + 1, handler );
+  } );
+}
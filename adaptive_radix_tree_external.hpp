@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "adaptive_radix_tree.hpp"
+
+/// Builds an ART from more entries than fit in memory at once.
+///
+/// Entries are inserted into an in-memory tree; whenever its nodes and suffix table use more than the memory
+/// budget (see CAdaptiveRadixTree::GetMemoryUsage), its keys are written in key order to an on-disk run, each key
+/// with its rows, and the tree is Reset. The index vector isn't part of the budget, since the result needs it as
+/// well. Build and Write merge all runs in a streaming k-way merge, which keeps only the current key of each run
+/// in memory, and give the same result as joining the partial trees would. Once MAX_RUN_COUNT runs are open,
+/// they are merged into one, so the number of open files stays bounded.
+///
+/// A run is a magic number, format version and row count, the NULL string rows, then records of key and rows,
+/// lengths and rows being 32 bit integers in native byte order. Write produces a single run, which Load reads
+/// back; a file of another format, version or byte order throws std::runtime_error.
+class CArtExternalBuilder
+{
+public:
+  static const size_t MAX_RUN_COUNT = 64;
+
+  /// Runs are temporary files in directory; they are unlinked as soon as they are created, so nothing is left
+  /// behind when the builder is destroyed. I/O errors throw std::system_error.
+  explicit CArtExternalBuilder( size_t memory_budget, const std::string & directory = "/tmp" );
+
+  CArtExternalBuilder( const CArtExternalBuilder & other ) = delete;
+  CArtExternalBuilder& operator=( const CArtExternalBuilder& ) = delete;
+
+  ~CArtExternalBuilder();
+
+  void AddEntry( const char* key, size_t key_length, uint32_t value );
+
+  void AddNullString( uint32_t value );
+
+  /// Merges everything added into a tree whose index vector covers the largest row added.
+  /// Builder is left empty. If nothing was spilled, the in-memory tree is returned as is.
+  std::unique_ptr<CAdaptiveRadixTree> Build();
+
+  /// Merges everything added into a single run written to path. Builder is left empty.
+  void Write( const std::string & path );
+
+  /// Builds a tree from a file written by Write.
+  static std::unique_ptr<CAdaptiveRadixTree> Load( const std::string & path );
+
+  /// Number of runs open, at most MAX_RUN_COUNT.
+  size_t GetRunCount() const
+  {
+    return runs_.size();
+  }
+
+private:
+  class CRunReader;
+
+  /// Writes the in-memory tree as a new run and resets it, merging all runs into one first if there are
+  /// MAX_RUN_COUNT of them.
+  void Spill();
+
+  /// Creates an unlinked temporary file in directory_.
+  FILE* CreateRun() const;
+
+  /// Writes a run of row_count rows merged from runs into file.
+  static void MergeInto( const std::vector<FILE*> & runs, uint32_t row_count, FILE* file );
+
+  void Clear();
+
+  /// Merges given runs, calls null_function( rows ) once and then function( key, rows ) for each key in key order.
+  template <typename NullFunction, typename Function>
+  static uint32_t Merge( const std::vector<FILE*> & runs, NullFunction null_function, Function function );
+
+  static std::unique_ptr<CAdaptiveRadixTree> BuildTree( const std::vector<FILE*> & runs );
+
+  size_t memory_budget_;
+  std::string directory_;
+  uint32_t row_count_ = 0;
+  std::unique_ptr<CAdaptiveRadixTree> tree_;
+  std::vector<FILE*> runs_;
+};
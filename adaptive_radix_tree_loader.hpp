@@ -0,0 +1,44 @@
+#pragma once
+
+#include <memory>
+#include <string>
+
+#include "adaptive_radix_tree.hpp"
+
+/// Builds ARTs from files of delimiter separated records (e.g. an exported column, one value per line)
+/// without copying them: file is memory mapped and keys are passed to CAdaptiveRadixTree::AddEntry as
+/// pointers into the mapping.
+class CArtFileLoader
+{
+public:
+  /// Maps given file, throws std::system_error if it can't be opened or mapped.
+  explicit CArtFileLoader( const std::string& path );
+
+  CArtFileLoader( const CArtFileLoader& other ) = delete;
+  CArtFileLoader& operator=( const CArtFileLoader& ) = delete;
+
+  ~CArtFileLoader();
+
+  /// Builds a tree whose i-th record gets row index i; empty records are added as NULL strings.
+  /// The last record doesn't need to be terminated with delimiter.
+  /// If threads > 1, file is cut into that many parts at record boundaries, each part is inserted into
+  /// its own tree sharing index vector of the result, and they are joined at the end.
+  std::unique_ptr<CAdaptiveRadixTree> Build( char delimiter = '\n', unsigned threads = 1 ) const;
+
+  /// Returns number of records in [begin, end) of the mapping.
+  static size_t CountRecords( const char* begin, const char* end, char delimiter );
+
+  const char* data() const
+  {
+    return data_;
+  }
+
+  size_t size() const
+  {
+    return size_;
+  }
+
+private:
+  const char* data_ = nullptr;
+  size_t size_ = 0;
+};
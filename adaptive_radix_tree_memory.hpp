@@ -0,0 +1,108 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+/// Where and on which kind of pages CAdaptiveRadixTree places its index vector and nodes.
+/// Every part of the policy is best effort: if the kernel doesn't support it or there are no
+/// huge pages reserved, memory is allocated as usual.
+struct CArtMemoryPolicy
+{
+  enum PageSize
+  {
+    DefaultPages,
+    /// madvise( MADV_HUGEPAGE ), needs transparent huge pages in "madvise" or "always" mode.
+    TransparentHugePages,
+    /// MAP_HUGETLB for nodes, needs pages reserved in /proc/sys/vm/nr_hugepages; falls back to transparent
+    /// huge pages. Index vector is a std::vector, so it always uses transparent huge pages instead.
+    ExplicitHugePages,
+  };
+
+  enum Placement
+  {
+    DefaultPlacement,
+    /// Memory of the NUMA node of the thread touching it first, even if process policy says otherwise.
+    LocalPlacement,
+    /// Pages spread round robin over all allowed NUMA nodes.
+    InterleavedPlacement,
+  };
+
+  CArtMemoryPolicy( PageSize page_size = DefaultPages, Placement placement = DefaultPlacement )
+      : page_size_( page_size ),
+        placement_( placement )
+  {
+  }
+
+  /// Applies policy to not yet touched pages of [address, address + length), which are not required to be
+  /// page aligned; only the pages lying completely inside are affected. Returns false if a part of the
+  /// policy couldn't be applied.
+  bool Apply( void* address, size_t length ) const;
+
+  PageSize page_size_;
+  Placement placement_;
+};
+
+/// Allocates CArtNodes from 2 MB chunks mapped according to a CArtMemoryPolicy, so nodes of a tree are
+/// packed into few (huge) pages instead of being scattered over the heap. Where mmap isn't available,
+/// chunks are aligned heap blocks and the policy isn't applied.
+///
+/// Each chunk begins with a pointer to its pool and chunks are aligned to their size, so memory of
+/// a node can be released knowing only its address (see Release), which lets nodes outlive the tree
+/// that allocated them as long as the pool is kept alive. Blocks are grouped by size class, which is
+/// the node type. Released blocks are pushed onto a lock free list of their class, which Allocate takes
+/// over as a whole once its own free list of that class is empty; chunks are unmapped only when the pool
+/// is destroyed.
+class CArtNodePool
+{
+public:
+  static const size_t CHUNK_SIZE = 2 * 1024 * 1024;
+  static const unsigned SIZE_CLASS_COUNT = 4;
+
+  explicit CArtNodePool( const CArtMemoryPolicy& policy )
+      : policy_( policy )
+  {
+  }
+
+  CArtNodePool( const CArtNodePool& other ) = delete;
+  CArtNodePool& operator=( const CArtNodePool& ) = delete;
+
+  ~CArtNodePool();
+
+  /// Returns size bytes aligned for a node, throws std::bad_alloc if no chunk can be mapped. Blocks of a
+  /// size class must all have the same size. Not thread safe, a pool is allocated from by one tree at a time.
+  void* Allocate( size_t size, unsigned size_class );
+
+  /// Returns a block allocated by any pool with given size class back to it.
+  /// Thread safe, so nodes shared with snapshots can be released from other threads.
+  static void Release( void* block, unsigned size_class );
+
+  const CArtMemoryPolicy& GetPolicy() const
+  {
+    return policy_;
+  }
+
+  /// Number of mapped chunks, not thread safe.
+  size_t GetChunkCount() const
+  {
+    return chunks_.size();
+  }
+
+private:
+  struct CChunkHeader
+  {
+    CArtNodePool* pool_;
+    void* allocation_;  //< start of the heap block holding the chunk, if it isn't mapped.
+  };
+
+  void MapChunk();
+
+  CArtMemoryPolicy policy_;
+  std::vector<char*> chunks_;
+  char* free_begin_ = nullptr;  //< unused part of the last chunk.
+  char* free_end_ = nullptr;
+  void* free_lists_[SIZE_CLASS_COUNT] = {};                   //< owned by Allocate.
+  std::atomic<void*> released_lists_[SIZE_CLASS_COUNT] = {};  //< pushed to by Release from any thread.
+};
@@ -1,14 +1,35 @@
 #pragma once
 
+#include <atomic>
 #include <iostream>
 #include <vector>
 #include <string>
 #include <map>
 #include <unordered_set>
 
+#include <cassert>
 #include <cstdint>
 #include <cstring>
 
+#include "adaptive_radix_tree_memory.hpp"
+
+#if defined( __SSE2__ ) || defined( __AVX2__ )
+#include <immintrin.h>
+#endif
+
+// Check for 64/32 bit system, CArtNode16 keeps its keys sign flipped on 64 bit systems.
+#if _WIN32 || _WIN64
+#if _WIN64
+#define ENVIRONMENT_64 1
+#endif
+#endif
+
+#if __GNUC__
+#if __x86_64__ || __ppc64__ || __PPC64__ || __aarch64__
+#define ENVIRONMENT_64 1
+#endif
+#endif
+
 struct CArtNode
 {
   // Represents final index for tuples.
@@ -26,23 +47,29 @@ struct CArtNode
       : prefix_length_( 0 ),
         prefix_position_( 0 ),
         value_( LAST_INDEX_IDENTIFIER ),
+        ref_count_( 1 ),
         children_count_( 0 ),
         node_type_( type ),
-        end_of_string_( false )
+        end_of_string_( false ),
+        pooled_( false )
   {
   }
 
   uint32_t prefix_length_;
   uint32_t prefix_position_;  //< prefix position in suffix table.
   uint32_t value_;            //< only meaningful if end of string.
+  std::atomic<uint32_t> ref_count_;  //< number of parents (or tree roots) pointing to node, see CAdaptiveRadixTree::Snapshot.
   uint16_t children_count_;
   uint8_t node_type_;
-  bool end_of_string_;
+  bool end_of_string_ : 1;
+  bool pooled_ : 1;  //< allocated from a CArtNodePool instead of with new.
 };
 
 struct CArtNode4: CArtNode
 {
-  CArtNode4() : CArtNode(CArtNode::Type::Fanout4 )
+  static const Type TYPE = Fanout4;
+
+  CArtNode4() : CArtNode( TYPE )
   {
     memset( key_, 0, sizeof( key_ ) );
     memset( child_, 0, sizeof( child_ ) );
@@ -55,7 +82,9 @@ struct CArtNode4: CArtNode
 
 struct CArtNode16: CArtNode
 {
-  CArtNode16() : CArtNode(CArtNode::Type::Fanout16 )
+  static const Type TYPE = Fanout16;
+
+  CArtNode16() : CArtNode( TYPE )
   {
     memset( key_, 0, sizeof( key_ ) );
     memset( child_, 0, sizeof( child_ ) );
@@ -68,8 +97,11 @@ struct CArtNode16: CArtNode
 
 struct CArtNode48: CArtNode
 {
-  CArtNode48() : CArtNode(CArtNode::Type::Fanout48 )
+  static const Type TYPE = Fanout48;
+
+  CArtNode48() : CArtNode( TYPE )
   {
+    memset( present_, 0, sizeof( present_ ) );
     memset( child_index_, EMPTY_MARKER, sizeof( child_index_ ) );
     memset( child_, 0, sizeof( child_ ) );
   }
@@ -77,42 +109,226 @@ struct CArtNode48: CArtNode
 
   static const uint8_t EMPTY_MARKER = 48;
 
+  uint64_t present_[4];  //< bit c is set if child_index_[c] isn't EMPTY_MARKER.
   uint8_t child_index_[256];
   CArtNode * child_[48];
 };
 
 struct CArtNode256: CArtNode
 {
-  CArtNode256() : CArtNode(CArtNode::Type::Fanout256 )
+  static const Type TYPE = Fanout256;
+
+  CArtNode256() : CArtNode( TYPE )
   {
+    memset( present_, 0, sizeof( present_ ) );
     memset( child_, ~0, sizeof( child_ ) );
   }
   ~CArtNode256();
 
   static CArtNode * EMPTY_NODE;
 
+  uint64_t present_[4];  //< bit c is set if child_[c] isn't EMPTY_NODE.
   CArtNode * child_[256];
 };
 
 namespace detail {
 struct Helper {
+  /// Drops one reference to node and deletes it along with its children if it was the last one.
   static void DeleteNode(CArtNode *node) {
+    if (node->ref_count_.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+      return;
+    }
+
     switch (node->node_type_) {
       case CArtNode::Fanout4:
-        delete static_cast<CArtNode4 *>(node);
+        Destroy(static_cast<CArtNode4 *>(node));
         break;
       case CArtNode::Fanout16:
-        delete static_cast<CArtNode16 *>(node);
+        Destroy(static_cast<CArtNode16 *>(node));
         break;
       case CArtNode::Fanout48:
-        delete static_cast<CArtNode48 *>(node);
+        Destroy(static_cast<CArtNode48 *>(node));
         break;
       case CArtNode::Fanout256:
-        delete static_cast<CArtNode256 *>(node);
+        Destroy(static_cast<CArtNode256 *>(node));
         break;
     }
   }
 
+  /// Destroys node and frees its memory the way it was allocated; node type is the size class in its pool.
+  template <typename Node>
+  static void Destroy(Node *node) {
+    if (node->pooled_) {
+      node->~Node();
+      CArtNodePool::Release(node, Node::TYPE);
+    } else {
+      delete node;
+    }
+  }
+
+  /// Copies everything but children and reference count.
+  static void CopyHeader(CArtNode *destination, const CArtNode *source) {
+    destination->prefix_length_ = source->prefix_length_;
+    destination->prefix_position_ = source->prefix_position_;
+    destination->value_ = source->value_;
+    destination->children_count_ = source->children_count_;
+    destination->end_of_string_ = source->end_of_string_;
+  }
+
+  /// Calls function( key byte, child slot ) for each child of node in key order.
+  template <typename Function>
+  static void ForEachChild(CArtNode *node, Function function) {
+    switch (node->node_type_) {
+      case CArtNode::Fanout4: {
+        auto node_4 = static_cast<CArtNode4 *>(node);
+        for (int i = 0; i < node_4->children_count_; ++i) {
+          function(node_4->key_[i], node_4->child_[i]);
+        }
+      }
+      break;
+
+      case CArtNode::Fanout16: {
+        auto node_16 = static_cast<CArtNode16 *>(node);
+        for (int i = 0; i < node_16->children_count_; ++i) {
+#if ENVIRONMENT_64
+          function(FlipSign(node_16->key_[i]), node_16->child_[i]);
+#else
+          function(node_16->key_[i], node_16->child_[i]);
+#endif
+        }
+      }
+      break;
+
+      case CArtNode::Fanout48: {
+        auto node_48 = static_cast<CArtNode48 *>(node);
+        assert(CountPresent(node_48->present_) == node_48->children_count_);
+        ForEachPresent(node_48->present_, [&](uint8_t c) {
+          function(c, node_48->child_[node_48->child_index_[c]]);
+        });
+      }
+      break;
+
+      case CArtNode::Fanout256: {
+        auto node_256 = static_cast<CArtNode256 *>(node);
+        assert(CountPresent(node_256->present_) == node_256->children_count_);
+        ForEachPresent(node_256->present_, [&](uint8_t c) { function(c, node_256->child_[c]); });
+      }
+      break;
+    }
+  }
+
+  /// Calls function( key byte, child slot ) in key order for each child of node whose key byte is in
+  /// [first, last]. Node48 and Node256 jump to their first child from their presence bitmap.
+  template <typename Function>
+  static void ForEachChildIn(CArtNode *node, uint8_t first, uint8_t last, Function function) {
+    switch (node->node_type_) {
+      case CArtNode::Fanout4:
+      case CArtNode::Fanout16:
+        ForEachChild(node, [&](uint8_t c, CArtNode *&child) {
+          if (c >= first && c <= last) {
+            function(c, child);
+          }
+        });
+        break;
+
+      case CArtNode::Fanout48: {
+        auto node_48 = static_cast<CArtNode48 *>(node);
+        for (int c = NextPresent(node_48->present_, first); c >= 0 && c <= last;
+             c = c < 255 ? NextPresent(node_48->present_, c + 1) : -1) {
+          function(static_cast<uint8_t>(c), node_48->child_[node_48->child_index_[c]]);
+        }
+      }
+      break;
+
+      case CArtNode::Fanout256: {
+        auto node_256 = static_cast<CArtNode256 *>(node);
+        for (int c = NextPresent(node_256->present_, first); c >= 0 && c <= last;
+             c = c < 255 ? NextPresent(node_256->present_, c + 1) : -1) {
+          function(static_cast<uint8_t>(c), node_256->child_[c]);
+        }
+      }
+      break;
+    }
+  }
+
+  /// Marks key byte c as present in a 256 bit presence bitmap of Node48 or Node256.
+  static void SetPresent(uint64_t *present, uint8_t c) {
+    present[c >> 6] |= uint64_t(1) << (c & 63);
+  }
+
+  /// Calls function( key byte ) for each set bit of a presence bitmap in ascending order, skipping
+  /// empty words and jumping from one set bit to the next with ctz64.
+  template <typename Function>
+  static void ForEachPresent(const uint64_t *present, Function function) {
+    for (unsigned word = 0; word < 4; ++word) {
+      for (uint64_t bits = present[word]; bits; bits &= bits - 1) {
+        function(static_cast<uint8_t>(word * 64 + ctz64(bits)));
+      }
+    }
+  }
+
+  /// Returns the smallest key byte >= c present in a presence bitmap, or -1 if there is none.
+  static int NextPresent(const uint64_t *present, unsigned c) {
+    unsigned word = c >> 6;
+    uint64_t bits = present[word] & (~uint64_t(0) << (c & 63));
+    while (!bits) {
+      if (++word == 4) {
+        return -1;
+      }
+      bits = present[word];
+    }
+    return static_cast<int>(word * 64 + ctz64(bits));
+  }
+
+  /// Number of set bits of a presence bitmap, which is the number of children.
+  static unsigned CountPresent(const uint64_t *present) {
+    unsigned count = 0;
+    for (unsigned word = 0; word < 4; ++word) {
+      count += popcount64(present[word]);
+    }
+    return count;
+  }
+
+  /// Returns length of the common prefix of [left, left + length) and [right, right + length).
+  /// Compares 32 bytes at a time if compiled with AVX2 (e.g. -mavx2), then 16 with SSE2, then 8 as words
+  /// whose XOR locates the first difference, and only the tail byte by byte; loads never pass length.
+  static size_t Mismatch(const char *left, const char *right, size_t length) {
+    size_t i = 0;
+#ifdef __AVX2__
+    for (; i + 32 <= length; i += 32) {
+      const __m256i equal = _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(left + i)),
+                                              _mm256_loadu_si256(reinterpret_cast<const __m256i *>(right + i)));
+      const uint32_t mask = ~static_cast<uint32_t>(_mm256_movemask_epi8(equal));
+      if (mask) {
+        return i + ctz64(mask);
+      }
+    }
+#endif
+#ifdef __SSE2__
+    for (; i + 16 <= length; i += 16) {
+      const __m128i equal = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(left + i)),
+                                           _mm_loadu_si128(reinterpret_cast<const __m128i *>(right + i)));
+      const uint16_t mask = static_cast<uint16_t>(~_mm_movemask_epi8(equal));
+      if (mask) {
+        return i + ctz(mask);
+      }
+    }
+#endif
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    for (; i + 8 <= length; i += 8) {
+      uint64_t left_word, right_word;
+      memcpy(&left_word, left + i, 8);
+      memcpy(&right_word, right + i, 8);
+      if (const uint64_t difference = left_word ^ right_word) {
+        return i + ctz64(difference) / 8;
+      }
+    }
+#endif
+    for (; i < length && left[i] == right[i]; ++i) {
+    }
+    return i;
+  }
+
   static uint8_t FlipSign(uint8_t keyByte) {
     // Flip the sign bit, enables signed SSE comparison of unsigned values, used by CArtNode16
     return keyByte ^ 128;
@@ -141,6 +357,34 @@ struct Helper {
       x = x >> 2;
     }
     return n - ( x & 1 );
+#endif
+  }
+
+  static unsigned popcount64(uint64_t x) {
+#ifdef __GNUC__
+    return __builtin_popcountll(x);
+#else
+    unsigned n = 0;
+    for ( ; x; x &= x - 1 )
+    {
+      ++n;
+    }
+    return n;
+#endif
+  }
+
+  static unsigned ctz64(uint64_t x) {
+// Count trailing zeros, only defined for x>0
+#ifdef __GNUC__
+    return __builtin_ctzll(x);
+#else
+    unsigned n = 0;
+    while ( !( x & 1 ) )
+    {
+      x >>= 1;
+      ++n;
+    }
+    return n;
 #endif
   }
 };
@@ -175,13 +419,7 @@ inline CArtNode48::~CArtNode48()
 {
   if ( children_count_ )
   {
-    for ( int i = 0; i < 256; ++i )
-    {
-      if ( child_index_[i] != CArtNode48::EMPTY_MARKER )
-      {
-        detail::Helper::DeleteNode(child_[child_index_[i]] );
-      }
-    }
+    detail::Helper::ForEachPresent( present_, [this]( uint8_t c ) { detail::Helper::DeleteNode( child_[child_index_[c]] ); } );
   }
 }
 
@@ -189,12 +427,6 @@ inline CArtNode256::~CArtNode256()
 {
   if ( children_count_ )
   {
-    for ( int i = 0; i < 256; ++i )
-    {
-      if ( child_[i] != CArtNode256::EMPTY_NODE )
-      {
-        detail::Helper::DeleteNode(child_[i] );
-      }
-    }
+    detail::Helper::ForEachPresent( present_, [this]( uint8_t c ) { detail::Helper::DeleteNode( child_[c] ); } );
   }
 }
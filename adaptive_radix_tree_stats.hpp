@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+/// Hot path counters are compiled in only if ART_ENABLE_STATS is defined, see CMakeLists.txt.
+#ifdef ART_ENABLE_STATS
+#define ART_STATS( statement ) statement
+#else
+#define ART_STATS( statement )
+#endif
+
+/// Counters collected by CAdaptiveRadixTree when ART_ENABLE_STATS is defined.
+/// Counters are not synchronized, so they are only exact for single threaded use.
+struct CArtStats
+{
+  /// Histograms have one bucket per power of two; bucket i counts values in [2^(i-1), 2^i).
+  static const int HISTOGRAM_SIZE = 33;
+
+  static int Bucket( uint64_t value )
+  {
+    int bucket = 0;
+    while ( value && bucket < HISTOGRAM_SIZE - 1 )
+    {
+      value >>= 1;
+      ++bucket;
+    }
+    return bucket;
+  }
+
+  CArtStats()
+  {
+    memset( this, 0, sizeof( *this ) );
+  }
+
+  void Add( const CArtStats& other )
+  {
+    const uint64_t* source = reinterpret_cast<const uint64_t*>( &other );
+    uint64_t* destination = reinterpret_cast<uint64_t*>( this );
+    for ( size_t i = 0; i < sizeof( *this ) / sizeof( uint64_t ); ++i )
+    {
+      destination[i] += source[i];
+    }
+  }
+
+  uint64_t insert_count_;            //< AddEntry calls.
+  uint64_t null_insert_count_;       //< AddNullString calls.
+  uint64_t lookup_count_;            //< key lookups.
+  uint64_t child_lookup_count_;      //< FindChild calls.
+  uint64_t grow_count_[3];           //< node growths indexed by source type: 4->16, 16->48, 48->256.
+  uint64_t prefix_split_count_;      //< nodes split because key diverges in the middle of their prefix.
+  uint64_t suffix_growth_count_;     //< suffix table reallocations.
+  uint64_t copied_node_count_;       //< nodes copied because they are shared with a snapshot.
+  uint64_t merge_count_;             //< Merge calls.
+  uint64_t moved_node_count_;        //< nodes visited by MovePrefix.
+  uint64_t traverse_count_;          //< traversal calls.
+  uint64_t traversed_node_count_;    //< nodes visited by traversals.
+
+  uint64_t depth_histogram_[HISTOGRAM_SIZE];          //< nodes visited per insertion.
+  uint64_t prefix_length_histogram_[HISTOGRAM_SIZE];  //< prefix lengths compared during insertions.
+};
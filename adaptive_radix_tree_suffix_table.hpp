@@ -0,0 +1,83 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+
+/// Append-only byte storage for node prefixes.
+///
+/// Underlying buffer is reference counted and bytes are never modified once they are
+/// written; growing the table allocates a new buffer instead of reallocating in place.
+/// So a copy of the table is cheap and it stays valid while the original keeps growing,
+/// which is what tree snapshots rely on.
+class CArtSuffixTable
+{
+public:
+  CArtSuffixTable() = default;
+
+  char operator[]( size_t position ) const
+  {
+    assert( position < size_ );
+    return data_[position];
+  }
+
+  const char* data() const
+  {
+    return data_;
+  }
+
+  size_t size() const
+  {
+    return size_;
+  }
+
+  size_t capacity() const
+  {
+    return capacity_;
+  }
+
+  void reserve( size_t new_capacity )
+  {
+    if ( new_capacity <= capacity_ )
+    {
+      return;
+    }
+
+    std::shared_ptr<char> buffer( new char[new_capacity], std::default_delete<char[]>() );
+    if ( size_ )
+    {
+      memcpy( buffer.get(), data_, size_ );
+    }
+    buffer_.swap( buffer );
+    data_ = buffer_.get();
+    capacity_ = new_capacity;
+  }
+
+  void append( const char* bytes, size_t length )
+  {
+    if ( !length )
+    {
+      return;  //< bytes may be null data() of an empty table.
+    }
+    if ( size_ + length > capacity_ )
+    {
+      reserve( std::max( std::max( capacity_ * 2, size_ + length ), size_t( 64 ) ) );
+    }
+    memcpy( data_ + size_, bytes, length );
+    size_ += length;
+  }
+
+  void append( const CArtSuffixTable& other, size_t position, size_t length )
+  {
+    assert( &other != this && position + length <= other.size_ );
+    append( other.data_ + position, length );
+  }
+
+private:
+  std::shared_ptr<char> buffer_;
+  char* data_ = nullptr;
+  size_t size_ = 0;
+  size_t capacity_ = 0;
+};
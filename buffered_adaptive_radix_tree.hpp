@@ -0,0 +1,91 @@
+#pragma once
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "adaptive_radix_tree.hpp"
+
+/// ART taking insertions into a small write buffer which is joined into the main tree in the background,
+/// as in an LSM tree.
+///
+/// The buffer is a CAdaptiveRadixTree created by Split, so it shares the index vector of the main tree and
+/// stays small enough to be cached; inserting into it doesn't touch the cold upper levels of the main tree.
+/// Once merge_threshold entries are buffered, a background thread swaps in a fresh buffer and Joins the
+/// full one into the main tree, so main tree is modified in large batches and never by inserting threads.
+///
+/// Reads consult the main tree, the buffer being joined and the current buffer, and add up their rows.
+/// They wait while a Join runs, and insertions wait while a read runs.
+class CBufferedAdaptiveRadixTree
+{
+public:
+  CBufferedAdaptiveRadixTree( uint32_t max_index_count, size_t merge_threshold );
+
+  /// Buffers insertions into given tree, which must not be used otherwise afterwards.
+  CBufferedAdaptiveRadixTree( std::unique_ptr<CAdaptiveRadixTree> main, size_t merge_threshold );
+
+  CBufferedAdaptiveRadixTree( const CBufferedAdaptiveRadixTree& other ) = delete;
+  CBufferedAdaptiveRadixTree& operator=( const CBufferedAdaptiveRadixTree& ) = delete;
+
+  /// Stops the background thread; buffered entries are dropped along with the trees.
+  ~CBufferedAdaptiveRadixTree();
+
+  /// Thread safe, inserts into the buffer.
+  void AddEntry( const char* key, size_t key_length, uint32_t value );
+
+  /// Thread safe, inserts into the buffer.
+  void AddNullString( uint32_t value );
+
+  /// Scans all trees into selection, see CAdaptiveRadixTree::ScanPoint. Thread safe.
+  size_t ScanPoint( const char* key, size_t key_length, CRowSelection & selection ) const;
+  size_t ScanRange( const char* low, size_t low_length, const char* high, size_t high_length,
+                    CRowSelection & selection ) const;
+  size_t ScanPrefix( const char* prefix, size_t prefix_length, CRowSelection & selection ) const;
+  size_t ScanNull( CRowSelection & selection ) const;
+
+  /// Calls action.HandleTuple for each key of each tree, so a key which is in several trees is handled
+  /// once per tree. Thread safe.
+  void TraverseIndexes( CIndexActionBase & action ) const;
+
+  /// Joins buffered entries into the main tree on calling thread and returns when they are there.
+  void Flush();
+
+  /// Stops the background thread, flushes and returns the main tree; this object must not be used afterwards.
+  std::unique_ptr<CAdaptiveRadixTree> Release();
+
+  /// Number of Joins into the main tree so far.
+  size_t GetMergeCount() const;
+
+private:
+  void Start();
+
+  void Stop();
+
+  /// Body of the background thread.
+  void Run();
+
+  /// Swaps in a new buffer and joins the full one into the main tree.
+  void Merge();
+
+  /// Calls scan( tree, selection ) for each tree, clearing selection only before the first one.
+  template <typename Scan>
+  size_t ScanAll( CRowSelection & selection, Scan scan ) const;
+
+  size_t merge_threshold_;
+
+  // locked in this order; main_mutex_ guards main tree and, while it is joined, merging_ tree.
+  mutable std::mutex main_mutex_;
+  mutable std::mutex buffer_mutex_;
+  std::mutex merge_mutex_;  //< serializes merges of the background thread and Flush.
+
+  std::unique_ptr<CAdaptiveRadixTree> main_;
+  std::unique_ptr<CAdaptiveRadixTree> merging_;  //< full buffer being joined, guarded by both mutexes.
+  std::unique_ptr<CAdaptiveRadixTree> buffer_;   //< guarded by buffer_mutex_.
+  size_t buffered_count_ = 0;                    //< entries in buffer_.
+  size_t merge_count_ = 0;                       //< guarded by main_mutex_.
+
+  bool stop_ = false;  //< guarded by buffer_mutex_.
+  std::condition_variable merge_needed_;
+  std::thread merger_;
+};
@@ -1,20 +1,11 @@
 #include "adaptive_radix_tree.hpp"
 
-// Check for 64/32 bit system
-#if _WIN32 || _WIN64
-#if _WIN64
-#define ENVIRONMENT_64 1
-#endif
-#endif
-
-#if __GNUC__
-#if __x86_64__ || __ppc64__ || __PPC64__ || __aarch64__
-#define ENVIRONMENT_64 1
-#endif
-#endif
-
 #include <algorithm>
 #include <cassert>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
 
 #if ENVIRONMENT_64
 #include <immintrin.h>
@@ -25,10 +16,13 @@
 #include <string>
 
 #include "adaptive_radix_tree_node.hpp"
+#include "succinct_radix_tree.hpp"
 #include "utils.hpp"
 
 CArtNode ** CAdaptiveRadixTree::FindChild(CArtNode * node, uint8_t c ) const
 {
+  ART_STATS( ++Stats().child_lookup_count_ );
+
   switch ( node->node_type_ )
   {
     case CArtNode::Type::Fanout4:
@@ -133,7 +127,8 @@ CArtNode **CAdaptiveRadixTree::InsertInNode(CArtNode ** base_node, uint8_t c, CA
       else
       {
         // Grow to CArtNode16
-        CArtNode16 * newNode = new CArtNode16();
+        ART_STATS( ++Stats().grow_count_[CArtNode::Type::Fanout4] );
+        CArtNode16 * newNode = NewNode<CArtNode16>();
 
         *base_node = newNode;
 
@@ -142,6 +137,7 @@ CArtNode **CAdaptiveRadixTree::InsertInNode(CArtNode ** base_node, uint8_t c, CA
         newNode->value_ = node->value_;
         newNode->prefix_position_ = node->prefix_position_;
         newNode->end_of_string_ = node->end_of_string_;
+        TrackLeaf( newNode );
 
         for ( unsigned i = 0; i < 4; ++i )
         {
@@ -154,7 +150,7 @@ CArtNode **CAdaptiveRadixTree::InsertInNode(CArtNode ** base_node, uint8_t c, CA
         memcpy( newNode->child_, node->child_, node->children_count_ * sizeof( uintptr_t ) );
 
         node->children_count_ = 0;  // prevent deletion of children
-        delete node;
+        detail::Helper::DeleteNode( node );
         return InsertInNode( base_node, c, child_node );
       }
     }
@@ -187,16 +183,19 @@ CArtNode **CAdaptiveRadixTree::InsertInNode(CArtNode ** base_node, uint8_t c, CA
       else
       {
         // Grow to CArtNode48
-        CArtNode48 * new_node = new CArtNode48();
+        ART_STATS( ++Stats().grow_count_[CArtNode::Type::Fanout16] );
+        CArtNode48 * new_node = NewNode<CArtNode48>();
         *base_node = new_node;
         memcpy( new_node->child_, node->child_, node->children_count_ * sizeof( uintptr_t ) );
         for ( unsigned i = 0; i < node->children_count_; ++i )
         {
 #if ENVIRONMENT_64
-          new_node->child_index_[detail::Helper::FlipSign( node->key_[i] )] = i;
+          const uint8_t c = detail::Helper::FlipSign( node->key_[i] );
 #else
-          new_node->child_index_[node->key_[i]] = i;
+          const uint8_t c = node->key_[i];
 #endif
+          new_node->child_index_[c] = i;
+          detail::Helper::SetPresent( new_node->present_, c );
         }
 
         new_node->children_count_ = node->children_count_;
@@ -204,9 +203,10 @@ CArtNode **CAdaptiveRadixTree::InsertInNode(CArtNode ** base_node, uint8_t c, CA
         new_node->value_ = node->value_;
         new_node->prefix_position_ = node->prefix_position_;
         new_node->end_of_string_ = node->end_of_string_;
+        TrackLeaf( new_node );
 
         node->children_count_ = 0;  // prevent deletion of children
-        delete node;
+        detail::Helper::DeleteNode( node );
         return InsertInNode( base_node, c, child_node );
       }
     }
@@ -226,31 +226,30 @@ CArtNode **CAdaptiveRadixTree::InsertInNode(CArtNode ** base_node, uint8_t c, CA
         }
         node->child_[pos] = child_node;
         node->child_index_[c] = pos;
+        detail::Helper::SetPresent( node->present_, c );
         ++node->children_count_;
         return &node->child_[pos];
       }
       else
       {
         // Grow to Node256
-        CArtNode256 * newNode = new CArtNode256();
-        for ( unsigned i = 0; i < 256; ++i )
-        {
-          if ( node->child_index_[i] != 48 )
-          {
-            newNode->child_[i] = node->child_[node->child_index_[i]];
-          }
-        }
+        ART_STATS( ++Stats().grow_count_[CArtNode::Type::Fanout48] );
+        CArtNode256 * newNode = NewNode<CArtNode256>();
+        memcpy( newNode->present_, node->present_, sizeof( newNode->present_ ) );
+        detail::Helper::ForEachPresent( node->present_,
+                                        [&]( uint8_t i ) { newNode->child_[i] = node->child_[node->child_index_[i]]; } );
 
         newNode->children_count_ = node->children_count_;
         newNode->prefix_length_ = node->prefix_length_;
         newNode->value_ = node->value_;
         newNode->prefix_position_ = node->prefix_position_;
         newNode->end_of_string_ = node->end_of_string_;
+        TrackLeaf( newNode );
 
         *base_node = newNode;
 
         node->children_count_ = 0;  // prevent deletion of children
-        delete node;
+        detail::Helper::DeleteNode( node );
         return InsertInNode( base_node, c, child_node );
       }
     }
@@ -261,6 +260,7 @@ CArtNode **CAdaptiveRadixTree::InsertInNode(CArtNode ** base_node, uint8_t c, CA
       CArtNode256 * node = static_cast<CArtNode256 *>( *base_node );
       ++node->children_count_;
       node->child_[(uint8_t)c] = child_node;
+      detail::Helper::SetPresent( node->present_, c );
       return &node->child_[(uint8_t)c];
     }
     break;
@@ -289,39 +289,226 @@ void CAdaptiveRadixTree::InsertValue(CArtNode ** node_base, CArtNode * node, uin
   node->value_ = value;
 }
 
+void CAdaptiveRadixTree::EnableRowTracking()
+{
+  tracking_.reset( new CRowTracking );
+  tracking_->Resize( indexes_->size() );
+
+  auto track_chain = [this]( uint32_t head, CArtNode * leaf, uint32_t key_length ) {
+    for ( uint32_t row = head, previous = CArtNode::LAST_INDEX_IDENTIFIER; row != CArtNode::LAST_INDEX_IDENTIFIER;
+          previous = row, row = ( *indexes_ )[row] )
+    {
+      tracking_->previous_[row] = previous;
+      tracking_->key_lengths_[row] = key_length;
+      tracking_->leaves_[row] = row == head ? leaf : nullptr;
+    }
+  };
+
+  track_chain( null_string_, nullptr, CRowTracking::NULL_ROW );
+
+  std::vector<std::pair<CArtNode *, uint32_t>> stack;
+  if ( root_ )
+  {
+    stack.emplace_back( root_, 0 );
+  }
+  while ( !stack.empty() )
+  {
+    CArtNode * node = stack.back().first;
+    uint32_t key_length = stack.back().second + node->prefix_length_;
+    stack.pop_back();
+
+    if ( node->end_of_string_ )
+    {
+      track_chain( node->value_, node, key_length );
+    }
+    detail::Helper::ForEachChild( node, [&]( uint8_t, CArtNode *& child ) {
+      stack.emplace_back( child, key_length + 1 );
+    } );
+  }
+}
+
+void CAdaptiveRadixTree::TrackRow( uint32_t row, CArtNode * leaf, uint32_t key_length )
+{
+  assert( tracking_->key_lengths_[row] == CRowTracking::ABSENT );
+  const uint32_t next = ( *indexes_ )[row];
+  tracking_->previous_[row] = CArtNode::LAST_INDEX_IDENTIFIER;
+  tracking_->key_lengths_[row] = key_length;
+  tracking_->leaves_[row] = leaf;
+  if ( next != CArtNode::LAST_INDEX_IDENTIFIER )
+  {
+    tracking_->previous_[next] = row;
+    tracking_->leaves_[next] = nullptr;
+  }
+}
+
+bool CAdaptiveRadixTree::DeleteRow( uint32_t row )
+{
+  assert( tracking_ );
+  CRowTracking & tracking = *tracking_;
+  if ( row >= tracking.key_lengths_.size() || tracking.key_lengths_[row] == CRowTracking::ABSENT )
+  {
+    return false;
+  }
+
+  const uint32_t next = ( *indexes_ )[row];
+  const uint32_t previous = tracking.previous_[row];
+  if ( previous != CArtNode::LAST_INDEX_IDENTIFIER )
+  {
+    ( *indexes_ )[previous] = next;
+  }
+  else
+  {
+    // row is head of its chain, so next row becomes the head.
+    CArtNode * leaf = tracking.leaves_[row];
+    if ( !leaf )
+    {
+      null_string_ = next;
+    }
+    else
+    {
+      leaf->value_ = next;
+      if ( next == CArtNode::LAST_INDEX_IDENTIFIER )
+      {
+        leaf->end_of_string_ = false;
+        --unique_string_count_;
+      }
+    }
+    if ( next != CArtNode::LAST_INDEX_IDENTIFIER )
+    {
+      tracking.leaves_[next] = leaf;
+    }
+  }
+  if ( next != CArtNode::LAST_INDEX_IDENTIFIER )
+  {
+    tracking.previous_[next] = previous;
+  }
+
+  if ( tracking.key_lengths_[row] == CRowTracking::NULL_ROW )
+  {
+    --null_string_count_;
+  }
+  else
+  {
+    total_string_length_ -= tracking.key_lengths_[row];
+  }
+  tracking.previous_[row] = CArtNode::LAST_INDEX_IDENTIFIER;
+  tracking.key_lengths_[row] = CRowTracking::ABSENT;
+  tracking.leaves_[row] = nullptr;
+  return true;
+}
+
+void CAdaptiveRadixTree::UpdateRow( uint32_t row, const char* key, size_t key_length )
+{
+  DeleteRow( row );
+  AddEntry( key, key_length, row );
+}
+
+uint32_t CAdaptiveRadixTree::AppendSuffix( const char* bytes, size_t length )
+{
+  ART_STATS( Stats().suffix_growth_count_ += ( suffix_table_->size() + length > suffix_table_->capacity() ) );
+  uint32_t position = static_cast<uint32_t>( suffix_table_->size() );
+  suffix_table_->append( bytes, length );
+  return position;
+}
+
 void CAdaptiveRadixTree::AddEntry(const char* key, size_t key_length, uint32_t value )
 {
   total_string_length_ += key_length;
   max_string_length_ = std::max( max_string_length_, key_length );
 
-  CArtNode ** node_base = &root_;
-  size_t depth = 0;
+  Insert( key, key_length, value, &root_, 0, nullptr );
+}
+
+void CAdaptiveRadixTree::AddEntries( const char* const* keys, const size_t* key_lengths, const uint32_t* values,
+                                     size_t count )
+{
+  size_t total_length = 0;
+  size_t max_length = max_string_length_;
+  for ( size_t i = 0; i < count; ++i )
+  {
+    total_length += key_lengths[i];
+    max_length = std::max( max_length, key_lengths[i] );
+  }
+  total_string_length_ += total_length;
+  max_string_length_ = max_length;
+
+  // a key adds at most its own length to suffix table, grow it once for whole batch.
+  if ( suffix_table_->size() + total_length > suffix_table_->capacity() )
+  {
+    suffix_table_->reserve( std::max( suffix_table_->size() + total_length, 2 * suffix_table_->capacity() ) );
+  }
+
+  // nodes visited by previous key along with the key offsets they start at. Nodes on the path may be replaced
+  // while inserting, but they stay at the same slot of their parents.
+  std::vector<std::pair<CArtNode **, size_t>> path;
+
+  for ( size_t i = 0; i < count; ++i )
+  {
+    const char* key = keys[i];
+    size_t key_length = key_lengths[i];
+
+    if ( path.empty() )
+    {
+      Insert( key, key_length, values[i], &root_, 0, &path );
+      continue;
+    }
+
+    // resume from deepest node reached by the part shared with previous key.
+    const char* previous_key = keys[i - 1];
+    size_t common_length =
+        detail::Helper::Mismatch( key, previous_key, std::min( key_length, key_lengths[i - 1] ) );
+
+    while ( path.back().second > common_length )
+    {
+      path.pop_back();
+    }
+
+    auto resume = path.back();
+    path.pop_back();
+    Insert( key, key_length, values[i], resume.first, resume.second, &path );
+  }
+}
+
+void CAdaptiveRadixTree::Insert( const char* key, size_t key_length, uint32_t value, CArtNode ** node_base,
+                                 size_t depth, std::vector<std::pair<CArtNode **, size_t>> * path )
+{
+  ART_STATS( ++Stats().insert_count_ );
+  ART_STATS( size_t levels = 0 );
+
   size_t mismatch_position = 0;
 
-  CArtNode * node = *node_base;
+  CArtNode * node = MakeUnique( node_base );
 
   while ( node )
   {
-    // how much of prefix matches with key?
-    for ( ; depth + mismatch_position < key_length && mismatch_position < node->prefix_length_; ++mismatch_position )
+    ART_STATS( ++levels );
+    if ( path )
     {
-      if ( key[depth + mismatch_position] != suffix_table_[node->prefix_position_ + mismatch_position] )
-      {
-        break;
-      }
+      path->emplace_back( node_base, depth );
     }
+    ART_STATS( ++Stats().prefix_length_histogram_[CArtStats::Bucket( node->prefix_length_ )] );
+
+    // how much of prefix matches with key?
+    mismatch_position = detail::Helper::Mismatch( key + depth, suffix_table_->data() + node->prefix_position_,
+                                                  std::min<size_t>( key_length - depth, node->prefix_length_ ) );
 
     // if all of prefix is matched with key, that means we found end of string so insert numeric part!
     if ( depth + mismatch_position == key_length && mismatch_position == node->prefix_length_ )
     {
+      ART_STATS( ++Stats().depth_histogram_[CArtStats::Bucket( levels )] );
       InsertValue( node_base, node, value );
+      if ( tracking_ )
+      {
+        TrackRow( value, node, static_cast<uint32_t>( key_length ) );
+      }
       return;
     }
 
     // only part of prefix is matched with key. {key: alize, prefix: alt} => mismatched_position: 2
     if ( mismatch_position < node->prefix_length_ )
     {
-      CArtNode * new_node = new CArtNode4();
+      ART_STATS( ++Stats().prefix_split_count_ );
+      CArtNode * new_node = NewNode<CArtNode4>();
 
       *node_base = new_node;
 
@@ -337,7 +524,7 @@ void CAdaptiveRadixTree::AddEntry(const char* key, size_t key_length, uint32_t v
 
       // handle unmatched prefix part
       // use the same node (updated its prefix info) as child of new node.
-      InsertInNode( node_base, suffix_table_[node->prefix_position_], node );
+      InsertInNode( node_base, ( *suffix_table_ )[node->prefix_position_], node );
       --node->prefix_length_;
       ++node->prefix_position_;
 
@@ -347,24 +534,28 @@ void CAdaptiveRadixTree::AddEntry(const char* key, size_t key_length, uint32_t v
         // add unmatched key part as separate Node4 & continue.
         size_t key_offset = depth + mismatch_position + 1; // +1 for addressing char.
         size_t remaining_length = key_length - key_offset;
-        CArtNode * new_node = new CArtNode4();
+        CArtNode * new_node = NewNode<CArtNode4>();
         new_node->prefix_length_ = static_cast<uint32_t>( remaining_length );
 
         if ( remaining_length )
         {
-          new_node->prefix_position_ = static_cast<uint32_t>( suffix_table_.size() );
-          suffix_table_.append( key + key_offset, remaining_length );
+          new_node->prefix_position_ = AppendSuffix( key + key_offset, remaining_length );
         }
 
         node_base = InsertInNode( node_base, key[depth + mismatch_position], new_node );
         depth += mismatch_position + 1;
         mismatch_position = 0;
-        node = *node_base;
+        node = MakeUnique( node_base );
         continue;
       }
       else
       {
+        ART_STATS( ++Stats().depth_histogram_[CArtStats::Bucket( levels )] );
         InsertValue( node_base, new_node, value );
+        if ( tracking_ )
+        {
+          TrackRow( value, new_node, static_cast<uint32_t>( key_length ) );
+        }
         return;
       }
     }
@@ -378,25 +569,24 @@ void CAdaptiveRadixTree::AddEntry(const char* key, size_t key_length, uint32_t v
         node_base = result;
         depth += mismatch_position + 1;
         mismatch_position = 0;
-        node = *node_base;
+        node = MakeUnique( node_base );
         continue;
       }
       else  // child does not exists, create&insert a node and continue on that.
       {
-        CArtNode * new_node = new CArtNode4();
+        CArtNode * new_node = NewNode<CArtNode4>();
         size_t key_offset = depth + mismatch_position + 1; // +1 for addressing char.
         new_node->prefix_length_ = static_cast<uint32_t>( key_length - key_offset );
 
         if ( new_node->prefix_length_ )
         {
-          new_node->prefix_position_ = static_cast<uint32_t>( suffix_table_.size() );
-          suffix_table_.append( key + key_offset, new_node->prefix_length_ );
+          new_node->prefix_position_ = AppendSuffix( key + key_offset, new_node->prefix_length_ );
         }
 
         node_base = InsertInNode( node_base, key[depth + mismatch_position], new_node );
         depth += mismatch_position + 1;
         mismatch_position = 0;
-        node = *node_base;
+        node = MakeUnique( node_base );
         // todo: when we insert a new node and assign everything left of key, we can skip comparison at the beginning
         // of loop.
         continue;
@@ -405,193 +595,1460 @@ void CAdaptiveRadixTree::AddEntry(const char* key, size_t key_length, uint32_t v
   }
 }
 
+CAdaptiveRadixTree::CAdaptiveRadixTree( uint32_t max_index_count, const CArtMemoryPolicy & memory_policy )
+    : root_( nullptr ),
+      indexes_( std::make_shared<std::vector<uint32_t>>() ),
+      node_pools_( 1, std::make_shared<CArtNodePool>( memory_policy ) ),
+      node_pool_( node_pools_.front().get() )
+{
+  // policy has to be applied before the pages are touched, so reserve first and value initialize afterwards.
+  indexes_->reserve( max_index_count );
+  memory_policy.Apply( indexes_->data(), max_index_count * sizeof( uint32_t ) );
+  indexes_->resize( max_index_count );
+
+  root_ = NewNode<CArtNode256>();
+}
+
+CAdaptiveRadixTree::CAdaptiveRadixTree( std::shared_ptr<std::vector<uint32_t>> indexes,
+                                        const CArtMemoryPolicy & memory_policy )
+    : root_( nullptr ),
+      indexes_( indexes ),
+      node_pools_( 1, std::make_shared<CArtNodePool>( memory_policy ) ),
+      node_pool_( node_pools_.front().get() )
+{
+  root_ = NewNode<CArtNode256>();
+}
+
+CAdaptiveRadixTree::CAdaptiveRadixTree( uint32_t max_index_count, std::shared_ptr<CArtArena> arena )
+    : root_( nullptr ),
+      indexes_( std::make_shared<std::vector<uint32_t>>( max_index_count ) ),
+      small_( true )
+{
+  if ( arena )
+  {
+    node_pools_.push_back( arena->node_pool_ );
+    node_pool_ = arena->node_pool_.get();
+    suffix_table_ = arena->suffix_table_;
+  }
+  root_ = NewRoot();
+}
+
 std::unique_ptr<CAdaptiveRadixTree> CAdaptiveRadixTree::Split()
 {
+  assert( !tracking_ );
+  if ( small_ )
+  {
+    std::unique_ptr<CAdaptiveRadixTree> result( new CAdaptiveRadixTree( nullptr, indexes_ ) );
+    result->small_ = true;
+    // pools aren't thread safe, and split trees are usually filled by different threads.
+    if ( node_pool_ )
+    {
+      result->node_pools_.push_back( std::make_shared<CArtNodePool>( node_pool_->GetPolicy() ) );
+      result->node_pool_ = result->node_pools_.front().get();
+    }
+    result->root_ = result->NewRoot();
+    return result;
+  }
+  if ( node_pool_ )
+  {
+    return std::make_unique<CAdaptiveRadixTree>( indexes_, node_pool_->GetPolicy() );
+  }
   return std::make_unique <CAdaptiveRadixTree> (this->indexes_);
 }
 
-// todo(demiroz): compare performance with version using stack structure.
-void CAdaptiveRadixTree::TraverseRecursive(CArtNode * iNode, CActionBase & action, std::string& key, int level ) const
+struct CAdaptiveRadixTree::CRangeSplit
 {
-  action.HandleNode( iNode, key, level );
+  /// Returns range of the key having given number of keys before it.
+  size_t RangeOf( size_t before ) const
+  {
+    return std::min( parts_.size() - 1, before * parts_.size() / key_count_ );
+  }
 
-  if ( iNode->prefix_length_ )
+  std::unordered_map<const CArtNode *, size_t> key_counts_;
+  size_t key_count_ = 0;
+  std::vector<std::unique_ptr<CAdaptiveRadixTree>> parts_;
+};
+
+std::vector<std::unique_ptr<CAdaptiveRadixTree>> CAdaptiveRadixTree::SplitByRange( size_t k )
+{
+  assert( !tracking_ && k );
+  CRangeSplit split;
+  for ( size_t i = 0; i < k; ++i )
   {
-    key.append( suffix_table_, iNode->prefix_position_, iNode->prefix_length_ );
-    level += iNode->prefix_length_;
+    split.parts_.push_back( Split() );
+    // moved nodes stay in our pools.
+    for ( auto & pool : node_pools_ )
+    {
+      auto & part_pools = split.parts_.back()->node_pools_;
+      if ( std::find( part_pools.begin(), part_pools.end(), pool ) == part_pools.end() )
+      {
+        part_pools.push_back( pool );
+      }
+    }
   }
 
-  if ( iNode->end_of_string_ )
+  split.key_count_ = root_ ? CountKeys( root_, split ) : 0;
+  if ( split.key_count_ )
   {
-    action.HandleTuple( key, CIndexIterator(*indexes_, iNode->value_ ),
-                        CIndexIterator(*indexes_, CArtNode::LAST_INDEX_IDENTIFIER ) );
+    std::string path;
+    size_t before = 0;
+    SplitRecursive( &root_, path, before, split );
   }
 
-  switch ( iNode->node_type_ )
+  CAdaptiveRadixTree & first = *split.parts_[0];
+  first.null_string_ = null_string_;
+  first.null_string_count_ = null_string_count_;
+  for ( auto & part : split.parts_ )
+  {
+    // our maximum bounds the keys of each part while they are walked.
+    part->max_string_length_ = max_string_length_;
+    size_t max_string_length = 0;
+    part->unique_string_count_ = 0;
+    part->ForEachKey( [&]( const char*, size_t key_length, CIndexIterator begin, CIndexIterator end ) {
+      ++part->unique_string_count_;
+      part->total_string_length_ += key_length * std::distance( begin, end );
+      max_string_length = std::max( max_string_length, key_length );
+    } );
+    part->max_string_length_ = max_string_length;
+  }
+
+  Reset();
+  total_string_length_ = 0;
+  max_string_length_ = 0;
+  return std::move( split.parts_ );
+}
+
+size_t CAdaptiveRadixTree::CountKeys( CArtNode * node, CRangeSplit & split ) const
+{
+  size_t count = node->end_of_string_ ? 1 : 0;
+  detail::Helper::ForEachChild( node, [&]( uint8_t, CArtNode *& child ) { count += CountKeys( child, split ); } );
+  split.key_counts_[node] = count;
+  return count;
+}
+
+void CAdaptiveRadixTree::SplitRecursive( CArtNode ** node_base, std::string & path, size_t & before,
+                                         CRangeSplit & split )
+{
+  const size_t count = split.key_counts_[*node_base];
+  if ( !count )
+  {
+    detail::Helper::DeleteNode( *node_base );
+    *node_base = nullptr;
+    return;
+  }
+
+  const size_t range = split.RangeOf( before );
+  if ( range == split.RangeOf( before + count - 1 ) )
+  {
+    MoveSubtree( node_base, path, *split.parts_[range] );
+    before += count;
+    return;
+  }
+
+  // subtree spans several ranges, so node is cut and its key and children are moved one by one.
+  CArtNode * node = MakeUnique( node_base );
+  const size_t depth = path.size();
+  path.append( suffix_table_->data() + node->prefix_position_, node->prefix_length_ );
+  if ( node->end_of_string_ )
+  {
+    CArtNode * leaf = NewNode<CArtNode4>();
+    leaf->end_of_string_ = true;
+    leaf->value_ = node->value_;
+    node->end_of_string_ = false;
+    MoveSubtree( &leaf, path, *split.parts_[split.RangeOf( before++ )] );
+  }
+
+  detail::Helper::ForEachChild( node, [&]( uint8_t c, CArtNode *& child ) {
+    path.push_back( static_cast<char>( c ) );
+    SplitRecursive( &child, path, before, split );
+    path.pop_back();
+  } );
+
+  // children are moved already.
+  node->children_count_ = 0;
+  detail::Helper::DeleteNode( node );
+  *node_base = nullptr;
+  path.resize( depth );
+}
+
+void CAdaptiveRadixTree::MoveSubtree( CArtNode ** node_base, const std::string & path, CAdaptiveRadixTree & part )
+{
+  CArtNode * node = MakeUnique( node_base );
+
+  // prefixes below node are copied to the suffix table of part, so our table, which is about to be emptied
+  // but may be shared, doesn't grow.
+  detail::Helper::ForEachChild( node, [&]( uint8_t, CArtNode *& child ) { part.MovePrefix( &child, *suffix_table_ ); } );
+
+  // node becomes a child of the root of part, path being the start of its prefix.
+  if ( !path.empty() || part.suffix_table_ != suffix_table_ )
+  {
+    const uint32_t position = part.AppendSuffix( path.data(), path.size() );
+    part.AppendSuffix( suffix_table_->data() + node->prefix_position_, node->prefix_length_ );
+    node->prefix_position_ = position;
+    node->prefix_length_ += static_cast<uint32_t>( path.size() );
+  }
+  part.Merge( &part.root_, node_base, *part.suffix_table_ );
+  *node_base = nullptr;
+}
+
+void CAdaptiveRadixTree::Optimize()
+{
+  if ( !root_ )
+  {
+    return;
+  }
+
+  size_t prefix_bytes = 0;
+  std::vector<CArtNode *> stack( 1, root_ );
+  while ( !stack.empty() )
+  {
+    CArtNode * node = stack.back();
+    stack.pop_back();
+    prefix_bytes += node->prefix_length_;
+    detail::Helper::ForEachChild( node, [&]( uint8_t, CArtNode *& child ) { stack.push_back( child ); } );
+  }
+
+  auto pool = std::make_shared<CArtNodePool>( node_pool_ ? node_pool_->GetPolicy() : CArtMemoryPolicy() );
+  std::vector<std::shared_ptr<CArtNodePool>> old_pools( 1, pool );
+  old_pools.swap( node_pools_ );
+  node_pool_ = pool.get();
+
+  std::shared_ptr<CArtSuffixTable> old_suffix_table = std::make_shared<CArtSuffixTable>();
+  old_suffix_table.swap( suffix_table_ );
+  suffix_table_->reserve( prefix_bytes );
+
+  CArtNode * old_root = root_;
+  root_ = OptimizedCopy( old_root, *old_suffix_table );
+  if ( !root_ )
+  {
+    root_ = NewRoot();
+  }
+  detail::Helper::DeleteNode( old_root );
+}
+
+CArtNode * CAdaptiveRadixTree::OptimizedCopy( CArtNode * node, const CArtSuffixTable & old_suffix_table )
+{
+  // subtrees holding no key, e.g. left behind by DeleteRow, are dropped, so children are copied first.
+  std::vector<std::pair<uint8_t, CArtNode *>> children;
+  children.reserve( node->children_count_ );
+  detail::Helper::ForEachChild( node, [&]( uint8_t c, CArtNode *& child ) {
+    if ( CArtNode * child_copy = OptimizedCopy( child, old_suffix_table ) )
+    {
+      children.emplace_back( c, child_copy );
+    }
+  } );
+  const unsigned count = static_cast<unsigned>( children.size() );
+  if ( !count && !node->end_of_string_ )
+  {
+    return nullptr;
+  }
+
+  CArtNode * copy;
+  if ( count <= 4 )
+  {
+    copy = NewNode<CArtNode4>();
+  }
+  else if ( count <= 16 )
+  {
+    copy = NewNode<CArtNode16>();
+  }
+  else if ( count <= 48 )
+  {
+    copy = NewNode<CArtNode48>();
+  }
+  else
+  {
+    copy = NewNode<CArtNode256>();
+  }
+
+  detail::Helper::CopyHeader( copy, node );
+  copy->children_count_ = static_cast<uint16_t>( count );
+  TrackLeaf( copy );
+  if ( node->prefix_length_ )
+  {
+    copy->prefix_position_ = AppendSuffix( old_suffix_table.data() + node->prefix_position_, node->prefix_length_ );
+  }
+
+  // children were visited in key order, so they can be placed one after another.
+  for ( unsigned i = 0; i < count; ++i )
+  {
+    const uint8_t c = children[i].first;
+    CArtNode * child_copy = children[i].second;
+    switch ( copy->node_type_ )
+    {
+      case CArtNode::Type::Fanout4:
+        static_cast<CArtNode4 *>( copy )->key_[i] = c;
+        static_cast<CArtNode4 *>( copy )->child_[i] = child_copy;
+        break;
+
+      case CArtNode::Type::Fanout16:
+#if ENVIRONMENT_64
+        static_cast<CArtNode16 *>( copy )->key_[i] = detail::Helper::FlipSign( c );
+#else
+        static_cast<CArtNode16 *>( copy )->key_[i] = c;
+#endif
+        static_cast<CArtNode16 *>( copy )->child_[i] = child_copy;
+        break;
+
+      case CArtNode::Type::Fanout48:
+        static_cast<CArtNode48 *>( copy )->child_index_[c] = static_cast<uint8_t>( i );
+        static_cast<CArtNode48 *>( copy )->child_[i] = child_copy;
+        detail::Helper::SetPresent( static_cast<CArtNode48 *>( copy )->present_, c );
+        break;
+
+      case CArtNode::Type::Fanout256:
+        static_cast<CArtNode256 *>( copy )->child_[c] = child_copy;
+        detail::Helper::SetPresent( static_cast<CArtNode256 *>( copy )->present_, c );
+        break;
+    }
+  }
+  return copy;
+}
+
+std::unique_ptr<CSuccinctRadixTree> CAdaptiveRadixTree::FreezeSuccinct() const
+{
+  return std::unique_ptr<CSuccinctRadixTree>( new CSuccinctRadixTree( *this ) );
+}
+
+std::shared_ptr<const CAdaptiveRadixTree> CAdaptiveRadixTree::Snapshot() const
+{
+  assert( !tracking_ );
+  if ( root_ )
+  {
+    root_->ref_count_.fetch_add( 1, std::memory_order_relaxed );
+  }
+
+  std::shared_ptr<CAdaptiveRadixTree> snapshot( new CAdaptiveRadixTree( root_, indexes_ ) );
+  snapshot->null_string_ = null_string_;
+  snapshot->null_string_count_ = null_string_count_;
+  snapshot->max_string_length_ = max_string_length_;
+  snapshot->unique_string_count_ = unique_string_count_;
+  snapshot->total_string_length_ = total_string_length_;
+  // copy is detached from later appends to a shared table.
+  snapshot->suffix_table_ = std::make_shared<CArtSuffixTable>( *suffix_table_ );
+  snapshot->node_pools_ = node_pools_;
+  return snapshot;
+}
+
+CArtNode * CAdaptiveRadixTree::CopyNode( const CArtNode * node ) const
+{
+  switch ( node->node_type_ )
   {
     case CArtNode::Type::Fanout4:
     {
-      auto node = static_cast<CArtNode4 *>( iNode );
+      auto source = static_cast<const CArtNode4 *>( node );
+      CArtNode4 * copy = NewNode<CArtNode4>();
+      detail::Helper::CopyHeader( copy, source );
+      memcpy( copy->key_, source->key_, sizeof( copy->key_ ) );
+      memcpy( copy->child_, source->child_, sizeof( copy->child_ ) );
 
-      for ( int i = 0; i < node->children_count_; ++i )
+      for ( int i = 0; i < copy->children_count_; ++i )
       {
-        key.push_back( node->key_[i] );
-        TraverseRecursive( node->child_[i], action, key, level + 1 );
-        key.resize( level );
+        copy->child_[i]->ref_count_.fetch_add( 1, std::memory_order_relaxed );
       }
+      return copy;
     }
     break;
 
     case CArtNode::Type::Fanout16:
     {
-      auto node = static_cast<CArtNode16 *>( iNode );
+      auto source = static_cast<const CArtNode16 *>( node );
+      CArtNode16 * copy = NewNode<CArtNode16>();
+      detail::Helper::CopyHeader( copy, source );
+      memcpy( copy->key_, source->key_, sizeof( copy->key_ ) );
+      memcpy( copy->child_, source->child_, sizeof( copy->child_ ) );
 
-      for ( int i = 0; i < node->children_count_; ++i )
+      for ( int i = 0; i < copy->children_count_; ++i )
       {
-#if ENVIRONMENT_64
-        auto ch = detail::Helper::FlipSign( node->key_[i] );
-#else
-        auto ch = node->key_[i];
-#endif
-        if ( !ch )
-        {
-          continue;
-        }
-
-        key.push_back( ch );
-        if ( node->child_[i] )
+        if ( copy->child_[i] )
         {
-          TraverseRecursive( node->child_[i], action, key, level + 1 );
+          copy->child_[i]->ref_count_.fetch_add( 1, std::memory_order_relaxed );
         }
-        key.resize( level );
       }
+      return copy;
     }
     break;
 
     case CArtNode::Type::Fanout48:
     {
-      auto node = static_cast<CArtNode48 *>( iNode );
-
-      if ( node->children_count_ )
+      auto source = static_cast<const CArtNode48 *>( node );
+      CArtNode48 * copy = NewNode<CArtNode48>();
+      detail::Helper::CopyHeader( copy, source );
+      memcpy( copy->present_, source->present_, sizeof( copy->present_ ) );
+      memcpy( copy->child_index_, source->child_index_, sizeof( copy->child_index_ ) );
+      memcpy( copy->child_, source->child_, sizeof( copy->child_ ) );
+
+      for ( int i = 0; i < 48; ++i )
       {
-        for ( int i = 0; i < 256; ++i )
+        if ( copy->child_[i] )
         {
-          if ( node->child_index_[i] != CArtNode48::EMPTY_MARKER )
-          {
-            key.push_back( static_cast<char>( i ) );
-            if ( node->child_[node->child_index_[i]] )
-            {
-              TraverseRecursive( node->child_[node->child_index_[i]], action, key, level + 1 );
-            }
-            key.resize( level );
-          }
+          copy->child_[i]->ref_count_.fetch_add( 1, std::memory_order_relaxed );
         }
       }
+      return copy;
     }
     break;
 
     case CArtNode::Type::Fanout256:
     {
-      auto node = static_cast<CArtNode256 *>( iNode );
+      auto source = static_cast<const CArtNode256 *>( node );
+      CArtNode256 * copy = NewNode<CArtNode256>();
+      detail::Helper::CopyHeader( copy, source );
+      memcpy( copy->present_, source->present_, sizeof( copy->present_ ) );
+      memcpy( copy->child_, source->child_, sizeof( copy->child_ ) );
+
+      detail::Helper::ForEachPresent( copy->present_, [copy]( uint8_t i ) {
+        copy->child_[i]->ref_count_.fetch_add( 1, std::memory_order_relaxed );
+      } );
+      return copy;
+    }
+    break;
 
-      if ( node->children_count_ )
+    default:
+    {
+      assert( false );
+      return nullptr;
+    }
+    break;
+  }
+}
+
+CArtNode * CAdaptiveRadixTree::MakeUnique( CArtNode ** node_base ) const
+{
+  CArtNode * node = *node_base;
+  if ( node->ref_count_.load( std::memory_order_acquire ) == 1 )
+  {
+    return node;
+  }
+
+  // node is reachable from a snapshot, path copy it; copy takes over our reference to children.
+  ART_STATS( ++Stats().copied_node_count_ );
+  CArtNode * copy = CopyNode( node );
+  *node_base = copy;
+  TrackLeaf( copy );
+  detail::Helper::DeleteNode( node );
+  return copy;
+}
+
+// todo(demiroz): compare performance with version using stack structure.
+void CAdaptiveRadixTree::TraverseRecursive(CArtNode * iNode, CActionBase & action, std::string& key, int level ) const
+{
+  ART_STATS( ++Stats().traversed_node_count_ );
+  action.HandleNode( iNode, key, level );
+
+  if ( iNode->prefix_length_ )
+  {
+    key.append( suffix_table_->data() + iNode->prefix_position_, iNode->prefix_length_ );
+    level += iNode->prefix_length_;
+  }
+
+  if ( iNode->end_of_string_ )
+  {
+    action.HandleTuple( key, CIndexIterator(*indexes_, iNode->value_ ),
+                        CIndexIterator(*indexes_, CArtNode::LAST_INDEX_IDENTIFIER ) );
+  }
+
+  switch ( iNode->node_type_ )
+  {
+    case CArtNode::Type::Fanout4:
+    {
+      auto node = static_cast<CArtNode4 *>( iNode );
+
+      for ( int i = 0; i < node->children_count_; ++i )
+      {
+        key.push_back( node->key_[i] );
+        TraverseRecursive( node->child_[i], action, key, level + 1 );
+        key.resize( level );
+      }
+    }
+    break;
+
+    case CArtNode::Type::Fanout16:
+    {
+      auto node = static_cast<CArtNode16 *>( iNode );
+
+      for ( int i = 0; i < node->children_count_; ++i )
+      {
+#if ENVIRONMENT_64
+        auto ch = detail::Helper::FlipSign( node->key_[i] );
+#else
+        auto ch = node->key_[i];
+#endif
+        if ( !ch )
+        {
+          continue;
+        }
+
+        key.push_back( ch );
+        if ( node->child_[i] )
+        {
+          TraverseRecursive( node->child_[i], action, key, level + 1 );
+        }
+        key.resize( level );
+      }
+    }
+    break;
+
+    case CArtNode::Type::Fanout48:
+    {
+      auto node = static_cast<CArtNode48 *>( iNode );
+
+      if ( node->children_count_ )
+      {
+        detail::Helper::ForEachPresent( node->present_, [&]( uint8_t i ) {
+          key.push_back( static_cast<char>( i ) );
+          if ( node->child_[node->child_index_[i]] )
+          {
+            TraverseRecursive( node->child_[node->child_index_[i]], action, key, level + 1 );
+          }
+          key.resize( level );
+        } );
+      }
+    }
+    break;
+
+    case CArtNode::Type::Fanout256:
+    {
+      auto node = static_cast<CArtNode256 *>( iNode );
+
+      if ( node->children_count_ )
+      {
+        detail::Helper::ForEachPresent( node->present_, [&]( uint8_t i ) {
+          key.push_back( static_cast<char>( i ) );
+          TraverseRecursive( node->child_[i], action, key, level + 1 );
+          key.resize( level );
+        } );
+      }
+    }
+    break;
+  }
+}
+
+void CAdaptiveRadixTree::TraverseIndexRecursive(CArtNode * iNode, CIndexActionBase & action ) const
+{
+  ART_STATS( ++Stats().traversed_node_count_ );
+  if ( iNode->end_of_string_ )
+  {
+    action.HandleTuple(CIndexIterator(*indexes_, iNode->value_ ), CIndexIterator(*indexes_, CArtNode::LAST_INDEX_IDENTIFIER ) );
+  }
+
+  switch ( iNode->node_type_ )
+  {
+    case CArtNode::Type::Fanout4:
+    {
+      auto node = static_cast<CArtNode4 *>( iNode );
+
+      for ( int i = 0; i < node->children_count_; ++i )
+      {
+        TraverseIndexRecursive( node->child_[i], action );
+      }
+    }
+    break;
+
+    case CArtNode::Type::Fanout16:
+    {
+      auto node = static_cast<CArtNode16 *>( iNode );
+
+      for ( int i = 0; i < node->children_count_; ++i )
+      {
+#if ENVIRONMENT_64
+        auto ch = detail::Helper::FlipSign( node->key_[i] );
+#else
+        auto ch = node->key_[i];
+#endif
+        if ( !ch )
+        {
+          continue;
+        }
+
+        if ( node->child_[i] )
+        {
+          TraverseIndexRecursive( node->child_[i], action );
+        }
+      }
+    }
+    break;
+
+    case CArtNode::Type::Fanout48:
+    {
+      auto node = static_cast<CArtNode48 *>( iNode );
+
+      if ( node->children_count_ )
+      {
+        detail::Helper::ForEachPresent( node->present_, [&]( uint8_t i ) {
+          if ( node->child_[node->child_index_[i]] )
+          {
+            TraverseIndexRecursive( node->child_[node->child_index_[i]], action );
+          }
+        } );
+      }
+    }
+    break;
+
+    case CArtNode::Type::Fanout256:
+    {
+      auto node = static_cast<CArtNode256 *>( iNode );
+
+      if ( node->children_count_ )
+      {
+        detail::Helper::ForEachPresent( node->present_,
+                                        [&]( uint8_t i ) { TraverseIndexRecursive( node->child_[i], action ); } );
+      }
+    }
+    break;
+  }
+}
+
+template <typename Function>
+void CAdaptiveRadixTree::DescendPrefixes( const char* key, size_t key_length, Function function ) const
+{
+  ART_STATS( ++Stats().lookup_count_ );
+
+  CArtNode * node = root_;
+  size_t depth = 0;
+
+  while ( node )
+  {
+    if ( node->prefix_length_ )
+    {
+      if ( depth + node->prefix_length_ > key_length ||
+           detail::Helper::Mismatch( key + depth, suffix_table_->data() + node->prefix_position_,
+                                     node->prefix_length_ ) != node->prefix_length_ )
+      {
+        return;
+      }
+      depth += node->prefix_length_;
+    }
+
+    if ( node->end_of_string_ )
+    {
+      function( node, depth );
+    }
+
+    if ( depth == key_length )
+    {
+      return;
+    }
+
+    CArtNode ** child = FindChild( node, key[depth] );
+    node = child ? *child : nullptr;
+    ++depth;
+  }
+}
+
+bool CAdaptiveRadixTree::Find( const char* key, size_t key_length, CIndexIterator & begin,
+                               CIndexIterator & end ) const
+{
+  const CArtNode * found = nullptr;
+  DescendPrefixes( key, key_length, [&]( const CArtNode * node, size_t depth ) {
+    if ( depth == key_length )
+    {
+      found = node;
+    }
+  } );
+
+  if ( found )
+  {
+    begin = CIndexIterator( *indexes_, found->value_ );
+    end = CIndexIterator( *indexes_, CArtNode::LAST_INDEX_IDENTIFIER );
+  }
+  return found != nullptr;
+}
+
+int64_t CAdaptiveRadixTree::LongestPrefixMatch( const char* key, size_t key_length, CIndexIterator & begin,
+                                                CIndexIterator & end ) const
+{
+  const CArtNode * deepest = nullptr;
+  int64_t length = -1;
+
+  DescendPrefixes( key, key_length, [&]( const CArtNode * node, size_t depth ) {
+    deepest = node;
+    length = static_cast<int64_t>( depth );
+  } );
+
+  if ( deepest )
+  {
+    begin = CIndexIterator( *indexes_, deepest->value_ );
+    end = CIndexIterator( *indexes_, CArtNode::LAST_INDEX_IDENTIFIER );
+  }
+  return length;
+}
+
+#ifdef ART_ENABLE_STATS
+thread_local CArtStats * CAdaptiveRadixTree::worker_stats_ = nullptr;
+#endif
+
+std::vector<std::unique_ptr<CActionBase>> CAdaptiveRadixTree::TraverseParallel(
+    const std::function<std::unique_ptr<CActionBase>()> & action_factory, unsigned threads, bool ordered ) const
+{
+  ART_STATS( ++Stats().traverse_count_ );
+  if ( !threads )
+  {
+    threads = std::max( std::thread::hardware_concurrency(), 1u );
+  }
+
+  // A task traverses subtree of node, whose prefix starts after key. Expanded nodes are kept as tasks
+  // visiting only the node itself, so tasks are in key order and each visits a contiguous key range.
+  struct CTask
+  {
+    CArtNode * node_;
+    std::string key_;
+    bool subtree_;
+  };
+
+  std::vector<CTask> tasks;
+  if ( root_ )
+  {
+    tasks.push_back( CTask{root_, std::string(), true} );
+  }
+
+  // expand level by level until there are enough subtrees to balance load.
+  const size_t TASKS_PER_THREAD = 16;
+  for ( bool expanded = threads > 1; expanded && tasks.size() < threads * TASKS_PER_THREAD; )
+  {
+    expanded = false;
+    std::vector<CTask> next_tasks;
+    for ( CTask & task : tasks )
+    {
+      if ( !task.subtree_ || !task.node_->children_count_ )
       {
-        for ( int i = 0; i < 256; ++i )
+        next_tasks.push_back( std::move( task ) );
+        continue;
+      }
+
+      expanded = true;
+      std::string key = task.key_;
+      key.append( suffix_table_->data() + task.node_->prefix_position_, task.node_->prefix_length_ );
+      next_tasks.push_back( CTask{task.node_, std::move( task.key_ ), false} );
+      detail::Helper::ForEachChild( task.node_, [&]( uint8_t c, CArtNode *& child ) {
+        next_tasks.push_back( CTask{child, key + static_cast<char>( c ), true} );
+      } );
+    }
+    tasks.swap( next_tasks );
+  }
+
+  std::vector<std::unique_ptr<CActionBase>> actions( ordered ? tasks.size() : threads );
+  for ( auto & action : actions )
+  {
+    action = action_factory();
+  }
+
+  // deal out contiguous runs of tasks, a worker takes from the front of its own queue and steals from the back
+  // of others.
+  struct CWorkQueue
+  {
+    std::mutex mutex_;
+    std::deque<size_t> tasks_;
+  };
+  std::vector<CWorkQueue> queues( threads );
+  for ( size_t i = 0; i < tasks.size(); ++i )
+  {
+    queues[i * threads / tasks.size()].tasks_.push_back( i );
+  }
+
+  // workers count into their own stats, which are added to ours once they are joined.
+  ART_STATS( std::vector<CArtStats> worker_stats( threads ) );
+  auto worker = [&]( unsigned id ) {
+#ifdef ART_ENABLE_STATS
+    CArtStats * previous_stats = worker_stats_;
+    worker_stats_ = &worker_stats[id];
+    struct CRestore
+    {
+      CArtStats *& stats_;
+      CArtStats * previous_;
+      ~CRestore()
+      {
+        stats_ = previous_;
+      }
+    } restore{worker_stats_, previous_stats};
+#endif
+    std::string key;
+    key.reserve( max_string_length_ );
+    for ( ;; )
+    {
+      size_t index = tasks.size();
+      for ( unsigned i = 0; i < threads && index == tasks.size(); ++i )
+      {
+        CWorkQueue & queue = queues[( id + i ) % threads];
+        std::lock_guard<std::mutex> lock( queue.mutex_ );
+        if ( !queue.tasks_.empty() )
         {
-          if ( node->child_[i] != CArtNode256::EMPTY_NODE )  //< node is different than empty node
+          if ( i == 0 )
           {
-            key.push_back( static_cast<char>( i ) );
-            TraverseRecursive( node->child_[i], action, key, level + 1 );
-            key.resize( level );
+            index = queue.tasks_.front();
+            queue.tasks_.pop_front();
           }
+          else
+          {
+            index = queue.tasks_.back();
+            queue.tasks_.pop_back();
+          }
+        }
+      }
+      // tasks don't create new ones, so all work is taken once every queue is empty.
+      if ( index == tasks.size() )
+      {
+        return;
+      }
+
+      const CTask & task = tasks[index];
+      CActionBase & action = *actions[ordered ? index : id];
+      key = task.key_;
+      if ( task.subtree_ )
+      {
+        TraverseRecursive( task.node_, action, key, static_cast<int>( key.size() ) );
+      }
+      else
+      {
+        action.HandleNode( task.node_, key, static_cast<uint32_t>( key.size() ) );
+        if ( task.node_->end_of_string_ )
+        {
+          key.append( suffix_table_->data() + task.node_->prefix_position_, task.node_->prefix_length_ );
+          action.HandleTuple( key, CIndexIterator( *indexes_, task.node_->value_ ),
+                              CIndexIterator( *indexes_, CArtNode::LAST_INDEX_IDENTIFIER ) );
+        }
+      }
+    }
+  };
+
+  std::vector<std::thread> workers;
+  for ( unsigned i = 1; i < threads; ++i )
+  {
+    workers.emplace_back( worker, i );
+  }
+  worker( 0 );
+  for ( auto & thread : workers )
+  {
+    thread.join();
+  }
+#ifdef ART_ENABLE_STATS
+  for ( const CArtStats & stats : worker_stats )
+  {
+    Stats().Add( stats );
+  }
+#endif
+  return actions;
+}
+
+void CAdaptiveRadixTree::TraverseRange( const char* low, size_t low_length, const char* high, size_t high_length,
+                                        CActionBase & action ) const
+{
+  ART_STATS( ++Stats().traverse_count_ );
+  if ( root_ )
+  {
+    std::string key;
+    RangeRecursive( root_, detail::CKeyRangeCursor( low, low_length, high, high_length ), key, action );
+  }
+}
+
+void CAdaptiveRadixTree::RangeRecursive( CArtNode * node, detail::CKeyRangeCursor cursor, std::string & key,
+                                         CActionBase & action ) const
+{
+  ART_STATS( ++Stats().traversed_node_count_ );
+  const size_t depth = key.size();
+  if ( node->prefix_length_ )
+  {
+    key.append( suffix_table_->data() + node->prefix_position_, node->prefix_length_ );
+  }
+
+  // cursor covers key up to depth, so only prefix of the node and child bytes are compared.
+  if ( cursor.Advance( key.data(), depth, key.size() ) )
+  {
+    if ( node->end_of_string_ && cursor.Contains( key.size() ) )
+    {
+      action.HandleTuple( key, CIndexIterator( *indexes_, node->value_ ),
+                          CIndexIterator( *indexes_, CArtNode::LAST_INDEX_IDENTIFIER ) );
+    }
+
+    // children outside of the bounds are skipped without visiting them.
+    const size_t level = key.size();
+    uint8_t first, last;
+    if ( cursor.ChildBounds( level, first, last ) )
+    {
+      detail::Helper::ForEachChildIn( node, first, last, [&]( uint8_t c, CArtNode *& child ) {
+        key.push_back( c );
+        detail::CKeyRangeCursor child_cursor = cursor;
+        if ( child_cursor.Advance( key.data(), level, level + 1 ) )
+        {
+          RangeRecursive( child, child_cursor, key, action );
+        }
+        key.resize( level );
+      } );
+    }
+  }
+
+  key.resize( depth );
+}
+
+void CAdaptiveRadixTree::PrefixMatches( const char* key, size_t key_length, CActionBase & action ) const
+{
+  std::string prefix;
+  DescendPrefixes( key, key_length, [&]( const CArtNode * node, size_t depth ) {
+    prefix.assign( key, depth );
+    action.HandleTuple( prefix, CIndexIterator( *indexes_, node->value_ ),
+                        CIndexIterator( *indexes_, CArtNode::LAST_INDEX_IDENTIFIER ) );
+  } );
+}
+
+size_t CAdaptiveRadixTree::ScanPoint( const char* key, size_t key_length, CRowSelection & selection ) const
+{
+  selection.Begin();
+  CIndexIterator begin, end;
+  return Find( key, key_length, begin, end ) ? selection.Add( begin, end ) : 0;
+}
+
+size_t CAdaptiveRadixTree::ScanRange( const char* low, size_t low_length, const char* high, size_t high_length,
+                                      CRowSelection & selection ) const
+{
+  selection.Begin();
+  detail::CSelectAction action( selection );
+  TraverseRange( low, low_length, high, high_length, action );
+  return action.GetCount();
+}
+
+size_t CAdaptiveRadixTree::ScanPrefix( const char* prefix, size_t prefix_length, CRowSelection & selection ) const
+{
+  selection.Begin();
+  detail::CSelectAction action( selection );
+  if ( CArtNode * node = FindPrefixNode( prefix, prefix_length ) )
+  {
+    TraverseIndexRecursive( node, action );
+  }
+  return action.GetCount();
+}
+
+size_t CAdaptiveRadixTree::ScanNull( CRowSelection & selection ) const
+{
+  selection.Begin();
+  return selection.Add( GetNullStringBegin(), GetNullStringEnd() );
+}
+
+CArtNode * CAdaptiveRadixTree::FindPrefixNode( const char* prefix, size_t prefix_length ) const
+{
+  ART_STATS( ++Stats().lookup_count_ );
+
+  CArtNode * node = root_;
+  size_t depth = 0;
+  while ( node )
+  {
+    // prefix may end inside prefix of the node.
+    const size_t length = std::min<size_t>( node->prefix_length_, prefix_length - depth );
+    if ( detail::Helper::Mismatch( prefix + depth, suffix_table_->data() + node->prefix_position_, length ) != length )
+    {
+      return nullptr;
+    }
+    depth += node->prefix_length_;
+
+    if ( depth >= prefix_length )
+    {
+      return node;
+    }
+
+    CArtNode ** child = FindChild( node, prefix[depth] );
+    node = child ? *child : nullptr;
+    ++depth;
+  }
+  return nullptr;
+}
+
+/// Nondeterministic automaton of a LIKE pattern. State i means that first i characters of pattern are
+/// matched, so state pattern_length accepts. Sets of states are kept as bitsets of Words() words.
+class CAdaptiveRadixTree::CPatternAutomaton
+{
+public:
+  CPatternAutomaton( const char* pattern, size_t pattern_length, char any_string, char any_char )
+      : pattern_( pattern ),
+        length_( pattern_length ),
+        any_string_( any_string ),
+        any_char_( any_char ),
+        words_( ( pattern_length + 1 + 63 ) / 64 ),
+        matches_everything_from_( pattern_length + 1, false )
+  {
+    // from state i every continuation is accepted if rest of the pattern consists of any_string only.
+    for ( size_t i = length_; i-- > 0 && pattern_[i] == any_string_; )
+    {
+      matches_everything_from_[i] = true;
+    }
+  }
+
+  size_t Words() const
+  {
+    return words_;
+  }
+
+  void Initial( uint64_t * states ) const
+  {
+    memset( states, 0, words_ * sizeof( uint64_t ) );
+    states[0] = 1;
+    Close( states );
+  }
+
+  /// Computes states after consuming c, returns false if there are none.
+  bool Step( const uint64_t * states, char c, uint64_t * next ) const
+  {
+    memset( next, 0, words_ * sizeof( uint64_t ) );
+    bool any = false;
+    for ( size_t word = 0; word < words_; ++word )
+    {
+      for ( uint64_t bits = states[word]; bits; bits &= bits - 1 )
+      {
+        size_t i = word * 64 + detail::Helper::ctz64( bits );
+        if ( i == length_ )
+        {
+          continue;
         }
+
+        if ( pattern_[i] == any_string_ )
+        {
+          Set( next, i );
+          any = true;
+        }
+        else if ( pattern_[i] == any_char_ || pattern_[i] == c )
+        {
+          Set( next, i + 1 );
+          any = true;
+        }
+      }
+    }
+
+    if ( any )
+    {
+      Close( next );
+    }
+    return any;
+  }
+
+  bool Accepts( const uint64_t * states ) const
+  {
+    return Test( states, length_ );
+  }
+
+  /// Returns true if all keys starting with consumed characters match.
+  bool AcceptsEverything( const uint64_t * states ) const
+  {
+    for ( size_t word = 0; word < words_; ++word )
+    {
+      for ( uint64_t bits = states[word]; bits; bits &= bits - 1 )
+      {
+        if ( matches_everything_from_[word * 64 + detail::Helper::ctz64( bits )] )
+        {
+          return true;
+        }
+      }
+    }
+    return false;
+  }
+
+  /// Collects characters which can be consumed next in ascending order.
+  /// Returns false if a wildcard can consume any character.
+  bool NextLiterals( const uint64_t * states, std::string & literals ) const
+  {
+    literals.clear();
+    for ( size_t word = 0; word < words_; ++word )
+    {
+      for ( uint64_t bits = states[word]; bits; bits &= bits - 1 )
+      {
+        size_t i = word * 64 + detail::Helper::ctz64( bits );
+        if ( i == length_ )
+        {
+          continue;
+        }
+        if ( pattern_[i] == any_string_ || pattern_[i] == any_char_ )
+        {
+          return false;
+        }
+        literals.push_back( pattern_[i] );
+      }
+    }
+
+    std::sort( literals.begin(), literals.end(),
+               []( char l, char r ) { return static_cast<uint8_t>( l ) < static_cast<uint8_t>( r ); } );
+    literals.erase( std::unique( literals.begin(), literals.end() ), literals.end() );
+    return true;
+  }
+
+private:
+  /// Adds states reachable without consuming a character, any_string may match empty sequence.
+  void Close( uint64_t * states ) const
+  {
+    for ( size_t i = 0; i < length_; ++i )
+    {
+      if ( pattern_[i] == any_string_ && Test( states, i ) )
+      {
+        Set( states, i + 1 );
+      }
+    }
+  }
+
+  static void Set( uint64_t * states, size_t i )
+  {
+    states[i / 64] |= uint64_t( 1 ) << ( i % 64 );
+  }
+
+  static bool Test( const uint64_t * states, size_t i )
+  {
+    return ( states[i / 64] >> ( i % 64 ) ) & 1;
+  }
+
+  const char* pattern_;
+  size_t length_;
+  char any_string_;
+  char any_char_;
+  size_t words_;
+  std::vector<bool> matches_everything_from_;
+};
+
+void CAdaptiveRadixTree::MatchPattern( const char* pattern, size_t pattern_length, CActionBase & action,
+                                       char any_string, char any_char ) const
+{
+  ART_STATS( ++Stats().traverse_count_ );
+  if ( !root_ )
+  {
+    return;
+  }
+
+  CPatternAutomaton automaton( pattern, pattern_length, any_string, any_char );
+
+  // one state set for each key length, so states of a prefix are computed once for all keys sharing it.
+  std::vector<uint64_t> states( ( max_string_length_ + 1 ) * automaton.Words() );
+  automaton.Initial( states.data() );
+
+  std::string key;
+  key.reserve( max_string_length_ );
+  MatchRecursive( root_, automaton, states.data(), false, key, action );
+}
+
+void CAdaptiveRadixTree::MatchRecursive( CArtNode * node, const CPatternAutomaton & automaton, uint64_t * states,
+                                         bool everything, std::string & key, CActionBase & action ) const
+{
+  ART_STATS( ++Stats().traversed_node_count_ );
+
+  const size_t depth = key.size();
+  const size_t words = automaton.Words();
+
+  if ( node->prefix_length_ )
+  {
+    key.append( suffix_table_->data() + node->prefix_position_, node->prefix_length_ );
+  }
+
+  for ( size_t level = depth; !everything && level < key.size(); ++level )
+  {
+    everything = automaton.AcceptsEverything( states + level * words );
+    if ( !everything && !automaton.Step( states + level * words, key[level], states + ( level + 1 ) * words ) )
+    {
+      key.resize( depth );
+      return;
+    }
+  }
+
+  const size_t level = key.size();
+  uint64_t * current = states + level * words;
+  everything = everything || automaton.AcceptsEverything( current );
+
+  if ( node->end_of_string_ && ( everything || automaton.Accepts( current ) ) )
+  {
+    action.HandleTuple( key, CIndexIterator( *indexes_, node->value_ ),
+                        CIndexIterator( *indexes_, CArtNode::LAST_INDEX_IDENTIFIER ) );
+  }
+
+  std::string literals;
+  if ( !everything && automaton.NextLiterals( current, literals ) )
+  {
+    // only literals can follow, visit just the children which match them.
+    for ( char c : literals )
+    {
+      CArtNode ** child = FindChild( node, c );
+      if ( child )
+      {
+        automaton.Step( current, c, current + words );
+        key.push_back( c );
+        MatchRecursive( *child, automaton, states, false, key, action );
+        key.resize( level );
+      }
+    }
+  }
+  else
+  {
+    detail::Helper::ForEachChild( node, [&]( uint8_t c, CArtNode *& child ) {
+      if ( everything || automaton.Step( current, c, current + words ) )
+      {
+        key.push_back( c );
+        MatchRecursive( child, automaton, states, everything, key, action );
+        key.resize( level );
       }
+    } );
+  }
+
+  key.resize( depth );
+}
+
+uint32_t CAdaptiveRadixTree::NextDistanceRow( const uint32_t * previous, uint32_t * next, const char* query,
+                                              size_t query_length, char c )
+{
+  next[0] = previous[0] + 1;
+  uint32_t minimum = next[0];
+  for ( size_t j = 1; j <= query_length; ++j )
+  {
+    next[j] = std::min( std::min( previous[j], next[j - 1] ) + 1, previous[j - 1] + ( query[j - 1] != c ) );
+    minimum = std::min( minimum, next[j] );
+  }
+  return minimum;
+}
+
+void CAdaptiveRadixTree::FuzzySearch( const char* query, size_t query_length, uint32_t max_distance,
+                                      CActionBase & action ) const
+{
+  ART_STATS( ++Stats().traverse_count_ );
+  if ( !root_ )
+  {
+    return;
+  }
+
+  // one distance row for each key length; row of a prefix is computed once for all keys sharing it.
+  std::vector<uint32_t> rows( ( max_string_length_ + 1 ) * ( query_length + 1 ) );
+  for ( size_t j = 0; j <= query_length; ++j )
+  {
+    rows[j] = static_cast<uint32_t>( j );
+  }
+
+  std::string key;
+  key.reserve( max_string_length_ );
+  FuzzyRecursive( root_, query, query_length, max_distance, rows.data(), key, action );
+}
+
+void CAdaptiveRadixTree::FuzzyRecursive( CArtNode * node, const char* query, size_t query_length,
+                                         uint32_t max_distance, uint32_t * rows, std::string & key,
+                                         CActionBase & action ) const
+{
+  ART_STATS( ++Stats().traversed_node_count_ );
+
+  const size_t depth = key.size();
+  const size_t width = query_length + 1;
+
+  if ( node->prefix_length_ )
+  {
+    key.append( suffix_table_->data() + node->prefix_position_, node->prefix_length_ );
+  }
+
+  for ( size_t level = depth; level < key.size(); ++level )
+  {
+    if ( NextDistanceRow( rows + level * width, rows + ( level + 1 ) * width, query, query_length, key[level] ) >
+         max_distance )
+    {
+      key.resize( depth );
+      return;
     }
-    break;
   }
+
+  const size_t level = key.size();
+  uint32_t * current = rows + level * width;
+
+  if ( node->end_of_string_ && current[query_length] <= max_distance )
+  {
+    action.HandleTuple( key, CIndexIterator( *indexes_, node->value_ ),
+                        CIndexIterator( *indexes_, CArtNode::LAST_INDEX_IDENTIFIER ) );
+  }
+
+  detail::Helper::ForEachChild( node, [&]( uint8_t c, CArtNode *& child ) {
+    if ( NextDistanceRow( current, current + width, query, query_length, c ) <= max_distance )
+    {
+      key.push_back( c );
+      FuzzyRecursive( child, query, query_length, max_distance, rows, key, action );
+      key.resize( level );
+    }
+  } );
+
+  key.resize( depth );
 }
 
-void CAdaptiveRadixTree::TraverseIndexRecursive(CArtNode * iNode, CIndexActionBase & action ) const
+void CAdaptiveRadixTree::EmitRecursive( CArtNode * node, uint32_t offset, std::string & key,
+                                        CActionBase & action ) const
 {
-  if ( iNode->end_of_string_ )
+  ART_STATS( ++Stats().traversed_node_count_ );
+
+  const size_t depth = key.size();
+  key.append( suffix_table_->data() + node->prefix_position_ + offset, node->prefix_length_ - offset );
+
+  if ( node->end_of_string_ )
   {
-    action.HandleTuple(CIndexIterator(*indexes_, iNode->value_ ), CIndexIterator(*indexes_, CArtNode::LAST_INDEX_IDENTIFIER ) );
+    action.HandleTuple( key, CIndexIterator( *indexes_, node->value_ ),
+                        CIndexIterator( *indexes_, CArtNode::LAST_INDEX_IDENTIFIER ) );
   }
 
-  switch ( iNode->node_type_ )
+  const size_t level = key.size();
+  detail::Helper::ForEachChild( node, [&]( uint8_t c, CArtNode *& child ) {
+    key.push_back( c );
+    EmitRecursive( child, 0, key, action );
+    key.resize( level );
+  } );
+
+  key.resize( depth );
+}
+
+template <typename Function>
+void CAdaptiveRadixTree::WalkTogether( CArtNode * left, uint32_t left_offset, const CAdaptiveRadixTree & other,
+                                       CArtNode * right, uint32_t right_offset, std::string & key, Function & both,
+                                       CActionBase * left_only ) const
+{
+  ART_STATS( ++Stats().traversed_node_count_ );
+
+  const char* left_prefix = suffix_table_->data() + left->prefix_position_ + left_offset;
+  const char* right_prefix = other.suffix_table_->data() + right->prefix_position_ + right_offset;
+  const uint32_t left_length = left->prefix_length_ - left_offset;
+  const uint32_t right_length = right->prefix_length_ - right_offset;
+  const uint32_t common_length = std::min( left_length, right_length );
+
+  // how much of prefixes match?
+  const uint32_t mismatch_position =
+      static_cast<uint32_t>( detail::Helper::Mismatch( left_prefix, right_prefix, common_length ) );
+
+  if ( mismatch_position < common_length )  // subtrees diverge, no common key below.
   {
-    case CArtNode::Type::Fanout4:
+    if ( left_only )
     {
-      auto node = static_cast<CArtNode4 *>( iNode );
+      EmitRecursive( left, left_offset, key, *left_only );
+    }
+    return;
+  }
 
-      for ( int i = 0; i < node->children_count_; ++i )
+  const size_t depth = key.size();
+  key.append( left_prefix, common_length );
+  const size_t level = key.size();
+
+  if ( left_length == right_length )  // both nodes end here.
+  {
+    if ( left->end_of_string_ )
+    {
+      if ( right->end_of_string_ )
       {
-        TraverseIndexRecursive( node->child_[i], action );
+        both( key, left, right );
+      }
+      else if ( left_only )
+      {
+        left_only->HandleTuple( key, CIndexIterator( *indexes_, left->value_ ),
+                                CIndexIterator( *indexes_, CArtNode::LAST_INDEX_IDENTIFIER ) );
       }
     }
-    break;
 
-    case CArtNode::Type::Fanout16:
-    {
-      auto node = static_cast<CArtNode16 *>( iNode );
+    detail::Helper::ForEachChild( left, [&]( uint8_t c, CArtNode *& child ) {
+      CArtNode ** right_child = other.FindChild( right, c );
+      key.push_back( c );
+      if ( right_child )
+      {
+        WalkTogether( child, 0, other, *right_child, 0, key, both, left_only );
+      }
+      else if ( left_only )
+      {
+        EmitRecursive( child, 0, key, *left_only );
+      }
+      key.resize( level );
+    } );
+  }
+  else if ( left_length < right_length )  // left node ends, right prefix continues.
+  {
+    const uint8_t c = right_prefix[common_length];
 
-      for ( int i = 0; i < node->children_count_; ++i )
+    if ( left_only )
+    {
+      if ( left->end_of_string_ )
       {
-#if ENVIRONMENT_64
-        auto ch = detail::Helper::FlipSign( node->key_[i] );
-#else
-        auto ch = node->key_[i];
-#endif
-        if ( !ch )
+        left_only->HandleTuple( key, CIndexIterator( *indexes_, left->value_ ),
+                                CIndexIterator( *indexes_, CArtNode::LAST_INDEX_IDENTIFIER ) );
+      }
+
+      detail::Helper::ForEachChild( left, [&]( uint8_t child_key, CArtNode *& child ) {
+        key.push_back( child_key );
+        if ( child_key == c )
         {
-          continue;
+          WalkTogether( child, 0, other, right, right_offset + common_length + 1, key, both, left_only );
         }
-
-        if ( node->child_[i] )
+        else
         {
-          TraverseIndexRecursive( node->child_[i], action );
+          EmitRecursive( child, 0, key, *left_only );
         }
-      }
+        key.resize( level );
+      } );
     }
-    break;
-
-    case CArtNode::Type::Fanout48:
+    else
     {
-      auto node = static_cast<CArtNode48 *>( iNode );
-
-      if ( node->children_count_ )
+      CArtNode ** left_child = FindChild( left, c );
+      if ( left_child )
       {
-        for ( int i = 0; i < 256; ++i )
-        {
-          if ( node->child_index_[i] != CArtNode48::EMPTY_MARKER )
-          {
-            if ( node->child_[node->child_index_[i]] )
-            {
-              TraverseIndexRecursive( node->child_[node->child_index_[i]], action );
-            }
-          }
-        }
+        key.push_back( c );
+        WalkTogether( *left_child, 0, other, right, right_offset + common_length + 1, key, both, left_only );
       }
     }
-    break;
-
-    case CArtNode::Type::Fanout256:
+  }
+  else  // right node ends, left prefix continues.
+  {
+    CArtNode ** right_child = other.FindChild( right, left_prefix[common_length] );
+    if ( right_child )
     {
-      auto node = static_cast<CArtNode256 *>( iNode );
-
-      if ( node->children_count_ )
-      {
-        for ( int i = 0; i < 256; ++i )
-        {
-          if ( node->child_[i] != CArtNode256::EMPTY_NODE )  //< node is different than empty node
-          {
-            TraverseIndexRecursive( node->child_[i], action );
-          }
-        }
-      }
+      key.push_back( left_prefix[common_length] );
+      WalkTogether( left, left_offset + common_length + 1, other, *right_child, 0, key, both, left_only );
     }
-    break;
+    else if ( left_only )
+    {
+      EmitRecursive( left, left_offset + common_length, key, *left_only );
+    }
+  }
+
+  key.resize( depth );
+}
+
+void CAdaptiveRadixTree::MergeJoin( const CAdaptiveRadixTree & other, CJoinActionBase & action ) const
+{
+  ART_STATS( ++Stats().traverse_count_ );
+  if ( !root_ || !other.root_ )
+  {
+    return;
+  }
+
+  auto both = [&]( const std::string & key, const CArtNode * left, const CArtNode * right ) {
+    action.HandleTuple( key, CIndexIterator( *indexes_, left->value_ ),
+                        CIndexIterator( *indexes_, CArtNode::LAST_INDEX_IDENTIFIER ),
+                        CIndexIterator( *other.indexes_, right->value_ ),
+                        CIndexIterator( *other.indexes_, CArtNode::LAST_INDEX_IDENTIFIER ) );
+  };
+
+  std::string key;
+  WalkTogether( root_, 0, other, other.root_, 0, key, both, nullptr );
+}
+
+void CAdaptiveRadixTree::Intersect( const CAdaptiveRadixTree & other, CActionBase & action ) const
+{
+  ART_STATS( ++Stats().traverse_count_ );
+  if ( !root_ || !other.root_ )
+  {
+    return;
+  }
+
+  auto both = [&]( const std::string & key, const CArtNode * left, const CArtNode * ) {
+    action.HandleTuple( key, CIndexIterator( *indexes_, left->value_ ),
+                        CIndexIterator( *indexes_, CArtNode::LAST_INDEX_IDENTIFIER ) );
+  };
+
+  std::string key;
+  WalkTogether( root_, 0, other, other.root_, 0, key, both, nullptr );
+}
+
+void CAdaptiveRadixTree::Difference( const CAdaptiveRadixTree & other, CActionBase & action ) const
+{
+  ART_STATS( ++Stats().traverse_count_ );
+  if ( !root_ )
+  {
+    return;
+  }
+
+  std::string key;
+  if ( !other.root_ )
+  {
+    EmitRecursive( root_, 0, key, action );
+    return;
   }
+
+  auto both = []( const std::string &, const CArtNode *, const CArtNode * ) {};
+  WalkTogether( root_, 0, other, other.root_, 0, key, both, &action );
 }
 
 void CAdaptiveRadixTree::Reset()
@@ -601,21 +2058,33 @@ void CAdaptiveRadixTree::Reset()
     detail::Helper::DeleteNode(root_ );
   }
 
-  root_ = new CArtNode256();
+  node_bytes_ = 0;
+  root_ = NewRoot();
 
   null_string_ = CArtNode::LAST_INDEX_IDENTIFIER;
   null_string_count_ = 0;
   unique_string_count_ = 0;
-  std::string().swap( suffix_table_ );
+  if ( tracking_ )
+  {
+    EnableRowTracking();
+  }
+  // a shared suffix table is still used by other trees.
+  if ( suffix_table_.use_count() == 1 )
+  {
+    suffix_table_ = std::make_shared<CArtSuffixTable>();
+  }
 }
 
-void CAdaptiveRadixTree::MovePrefix(CArtNode * input_node, std::string& other_suffix_table )
+void CAdaptiveRadixTree::MovePrefix(CArtNode ** input_node_base, const CArtSuffixTable& other_suffix_table )
 {
-  if ( input_node->prefix_length_ )
+  ART_STATS( ++Stats().moved_node_count_ );
+  CArtNode * input_node = MakeUnique( input_node_base );
+
+  // trees sharing a suffix table don't need to copy prefixes.
+  if ( input_node->prefix_length_ && &other_suffix_table != suffix_table_.get() )
   {
-    size_t new_prefix_position = suffix_table_.size();
-    suffix_table_.append( other_suffix_table, input_node->prefix_position_, input_node->prefix_length_ );
-    input_node->prefix_position_ = new_prefix_position;
+    input_node->prefix_position_ =
+        AppendSuffix( other_suffix_table.data() + input_node->prefix_position_, input_node->prefix_length_ );
   }
 
   // no need to do anything for terminator nodes except increasing unique string count.
@@ -632,7 +2101,7 @@ void CAdaptiveRadixTree::MovePrefix(CArtNode * input_node, std::string& other_su
 
       for ( int i = 0; i < node->children_count_; ++i )
       {
-        MovePrefix( node->child_[i], other_suffix_table );
+        MovePrefix( &node->child_[i], other_suffix_table );
       }
     }
     break;
@@ -655,7 +2124,7 @@ void CAdaptiveRadixTree::MovePrefix(CArtNode * input_node, std::string& other_su
 
         if ( node->child_[i] )
         {
-          MovePrefix( node->child_[i], other_suffix_table );
+          MovePrefix( &node->child_[i], other_suffix_table );
         }
       }
     }
@@ -667,16 +2136,12 @@ void CAdaptiveRadixTree::MovePrefix(CArtNode * input_node, std::string& other_su
 
       if ( node->children_count_ )
       {
-        for ( int i = 0; i < 256; ++i )
-        {
-          if ( node->child_index_[i] != CArtNode48::EMPTY_MARKER )
+        detail::Helper::ForEachPresent( node->present_, [&]( uint8_t i ) {
+          if ( node->child_[node->child_index_[i]] )
           {
-            if ( node->child_[node->child_index_[i]] )
-            {
-              MovePrefix( node->child_[node->child_index_[i]], other_suffix_table );
-            }
+            MovePrefix( &node->child_[node->child_index_[i]], other_suffix_table );
           }
-        }
+        } );
       }
     }
     break;
@@ -687,36 +2152,26 @@ void CAdaptiveRadixTree::MovePrefix(CArtNode * input_node, std::string& other_su
 
       if ( node->children_count_ )
       {
-        for ( int i = 0; i < 256; ++i )
-        {
-          if ( node->child_[i] != CArtNode256::EMPTY_NODE )  //< node is different than empty node
-          {
-            MovePrefix( node->child_[i], other_suffix_table );
-          }
-        }
+        detail::Helper::ForEachPresent( node->present_,
+                                        [&]( uint8_t i ) { MovePrefix( &node->child_[i], other_suffix_table ); } );
       }
     }
     break;
   }
 }
 
-void CAdaptiveRadixTree::Merge(CArtNode ** left, CArtNode ** right, std::string& right_suffix_table_ )
+void CAdaptiveRadixTree::Merge(CArtNode ** left, CArtNode ** right, const CArtSuffixTable& right_suffix_table_ )
 {
+  ART_STATS( ++Stats().merge_count_ );
   size_t mismatch_position = 0;
   CArtNode ** node_base = left;
-  CArtNode * node_left = *left;
-  CArtNode * node_right = *right;
+  CArtNode * node_left = MakeUnique( left );
+  CArtNode * node_right = MakeUnique( right );
 
   // how much of prefix matches with left prefix?
-  for ( ; mismatch_position < node_left->prefix_length_ && mismatch_position < node_right->prefix_length_;
-        ++mismatch_position )
-  {
-    if ( suffix_table_[node_left->prefix_position_ + mismatch_position] !=
-         right_suffix_table_[node_right->prefix_position_ + mismatch_position] )
-    {
-      break;
-    }
-  }
+  mismatch_position = detail::Helper::Mismatch( suffix_table_->data() + node_left->prefix_position_,
+                                                right_suffix_table_.data() + node_right->prefix_position_,
+                                                std::min( node_left->prefix_length_, node_right->prefix_length_ ) );
 
   if ( mismatch_position == node_left->prefix_length_ && mismatch_position == node_right->prefix_length_ )
   {
@@ -732,7 +2187,7 @@ void CAdaptiveRadixTree::Merge(CArtNode ** left, CArtNode ** right, std::string&
   // mismatched_position: 2
   if ( mismatch_position < node_left->prefix_length_ )
   {
-    CArtNode * new_node = new CArtNode4();
+    CArtNode * new_node = NewNode<CArtNode4>();
     *node_base = new_node;
 
     // if at least one char is matched between left and right prefix, assign this part to new node as prefix.
@@ -750,7 +2205,7 @@ void CAdaptiveRadixTree::Merge(CArtNode ** left, CArtNode ** right, std::string&
 
     // handle unmatched left prefix part
     // use the same node (updated its prefix info) as child of new node.
-    InsertInNode( node_base, suffix_table_[node_left->prefix_position_], node_left );
+    InsertInNode( node_base, ( *suffix_table_ )[node_left->prefix_position_], node_left );
     --node_left->prefix_length_;
     ++node_left->prefix_position_;
 
@@ -761,7 +2216,7 @@ void CAdaptiveRadixTree::Merge(CArtNode ** left, CArtNode ** right, std::string&
       --node_right->prefix_length_;                                                // -1 for addressing char.
       char addressing_char = right_suffix_table_[node_right->prefix_position_++];  // +1 for addressing char
 
-      MovePrefix( node_right, right_suffix_table_ );
+      MovePrefix( right, right_suffix_table_ );
       node_base = InsertInNode( node_base, addressing_char, node_right );
       return;
     }
@@ -797,7 +2252,7 @@ void CAdaptiveRadixTree::Merge(CArtNode ** left, CArtNode ** right, std::string&
       ++node_right->prefix_position_;  // discard addressing character
       --node_right->prefix_length_;
 
-      MovePrefix( node_right, right_suffix_table_ );
+      MovePrefix( right, right_suffix_table_ );
       node_base = InsertInNode( node_base, addressing_char, node_right );
       return;
     }
@@ -805,7 +2260,164 @@ void CAdaptiveRadixTree::Merge(CArtNode ** left, CArtNode ** right, std::string&
   assert( false );
 }
 
-void CAdaptiveRadixTree::MergeChildNodes(CArtNode ** left, CArtNode * right, std::string& right_suffix_table_ )
+void CAdaptiveRadixTree::JoinMany( const std::vector<CAdaptiveRadixTree *> & others )
+{
+  assert( !tracking_ );
+  std::vector<CJoinCursor> cursors;
+  if ( root_ )
+  {
+    cursors.push_back( CJoinCursor{&root_, suffix_table_.get(), 0} );
+  }
+
+  for ( CAdaptiveRadixTree * other : others )
+  {
+    assert( other != this && other->indexes_ == indexes_ && !other->tracking_ );
+    for ( CIndexIterator it = other->GetNullStringBegin(), end = other->GetNullStringEnd(); it != end; )
+    {
+      auto value = *it;  // cache the value
+      ++it;
+      AddNullString( value );
+    }
+
+    for ( auto & pool : other->node_pools_ )
+    {
+      if ( std::find( node_pools_.begin(), node_pools_.end(), pool ) == node_pools_.end() )
+      {
+        node_pools_.push_back( pool );
+      }
+    }
+
+    if ( other->root_ )
+    {
+      cursors.push_back( CJoinCursor{&other->root_, other->suffix_table_.get(), 0} );
+    }
+    // keys found in several trees are subtracted while joining.
+    unique_string_count_ += other->unique_string_count_;
+    total_string_length_ += other->GetTotalStringLength();
+    max_string_length_ = std::max( max_string_length_, other->GetMaxStringLength() );
+  }
+
+  if ( !cursors.empty() )
+  {
+    root_ = JoinRecursive( cursors );
+  }
+}
+
+CArtNode * CAdaptiveRadixTree::JoinRecursive( const std::vector<CJoinCursor> & cursors )
+{
+  ART_STATS( ++Stats().merge_count_ );
+  if ( cursors.size() == 1 )
+  {
+    // nothing to join with, move the rest of the subtree.
+    const CJoinCursor & cursor = cursors[0];
+    CArtNode * node = MakeUnique( cursor.node_base_ );
+    node->prefix_position_ += cursor.offset_;
+    node->prefix_length_ -= cursor.offset_;
+    // prefixes in our suffix table stay where they are; keys were counted by JoinMany already.
+    if ( cursor.suffix_table_ != suffix_table_.get() )
+    {
+      const size_t unique_string_count = unique_string_count_;
+      MovePrefix( cursor.node_base_, *cursor.suffix_table_ );
+      unique_string_count_ = unique_string_count;
+    }
+    node = *cursor.node_base_;
+    *cursor.node_base_ = nullptr;
+    return node;
+  }
+
+  // prefix shared by all cursors.
+  const CArtNode * first = MakeUnique( cursors[0].node_base_ );
+  const char* first_prefix = cursors[0].suffix_table_->data() + first->prefix_position_ + cursors[0].offset_;
+  size_t prefix_length = first->prefix_length_ - cursors[0].offset_;
+  for ( size_t i = 1; i < cursors.size() && prefix_length; ++i )
+  {
+    const CArtNode * node = MakeUnique( cursors[i].node_base_ );
+    prefix_length = detail::Helper::Mismatch(
+        first_prefix, cursors[i].suffix_table_->data() + node->prefix_position_ + cursors[i].offset_,
+        std::min<size_t>( prefix_length, node->prefix_length_ - cursors[i].offset_ ) );
+  }
+
+  CArtNode * result = NewNode<CArtNode4>();
+  if ( prefix_length )
+  {
+    // prefix of a node of this tree is in our suffix table already.
+    auto own = std::find_if( cursors.begin(), cursors.end(),
+                             [&]( const CJoinCursor & cursor ) { return cursor.suffix_table_ == suffix_table_.get(); } );
+    result->prefix_position_ = own != cursors.end()
+                                   ? ( *own->node_base_ )->prefix_position_ + own->offset_
+                                   : AppendSuffix( first_prefix, prefix_length );
+    result->prefix_length_ = static_cast<uint32_t>( prefix_length );
+  }
+
+  // cursors of the children of result, by their byte.
+  std::vector<std::pair<uint8_t, CJoinCursor>> children;
+  std::vector<CArtNode **> consumed;
+  for ( const CJoinCursor & cursor : cursors )
+  {
+    CArtNode * node = MakeUnique( cursor.node_base_ );
+    const uint32_t offset = static_cast<uint32_t>( cursor.offset_ + prefix_length );
+    if ( offset < node->prefix_length_ )
+    {
+      // rest of the prefix continues below result.
+      const uint8_t c = static_cast<uint8_t>( ( *cursor.suffix_table_ )[node->prefix_position_ + offset] );
+      children.emplace_back( c, CJoinCursor{cursor.node_base_, cursor.suffix_table_, offset + 1} );
+      continue;
+    }
+
+    if ( node->end_of_string_ )
+    {
+      if ( !result->end_of_string_ )
+      {
+        result->end_of_string_ = true;
+        result->value_ = node->value_;
+      }
+      else
+      {
+        // rows of node are inserted at the head of the chain of result, each visited once; cursors of this tree
+        // come first, so only rows of others are relinked.
+        --unique_string_count_;
+        for ( uint32_t row = node->value_, next; row != CArtNode::LAST_INDEX_IDENTIFIER; row = next )
+        {
+          next = ( *indexes_ )[row];
+          ( *indexes_ )[row] = result->value_;
+          result->value_ = row;
+        }
+      }
+    }
+
+    detail::Helper::ForEachChild( node, [&]( uint8_t c, CArtNode *& child ) {
+      children.emplace_back( c, CJoinCursor{&child, cursor.suffix_table_, 0} );
+    } );
+    consumed.push_back( cursor.node_base_ );
+  }
+
+  std::stable_sort( children.begin(), children.end(),
+                    []( const std::pair<uint8_t, CJoinCursor> & left, const std::pair<uint8_t, CJoinCursor> & right ) {
+                      return left.first < right.first;
+                    } );
+  std::vector<CJoinCursor> group;
+  for ( size_t begin = 0, end; begin < children.size(); begin = end )
+  {
+    group.clear();
+    for ( end = begin; end < children.size() && children[end].first == children[begin].first; ++end )
+    {
+      group.push_back( children[end].second );
+    }
+    CArtNode * child = JoinRecursive( group );
+    InsertInNode( &result, children[begin].first, child );
+  }
+
+  // children of consumed nodes are taken over by result.
+  for ( CArtNode ** node_base : consumed )
+  {
+    ( *node_base )->children_count_ = 0;
+    detail::Helper::DeleteNode( *node_base );
+    *node_base = nullptr;
+  }
+  return result;
+}
+
+void CAdaptiveRadixTree::MergeChildNodes(CArtNode ** left, CArtNode * right, const CArtSuffixTable& right_suffix_table_ )
 {
   if ( right->end_of_string_ )
   {
@@ -836,7 +2448,7 @@ void CAdaptiveRadixTree::MergeChildNodes(CArtNode ** left, CArtNode * right, std
           }
           else
           {
-            MovePrefix( right_node->child_[i], right_suffix_table_ );
+            MovePrefix( &( right_node->child_[i] ), right_suffix_table_ );
             // insert unique child in current left node as child.
             InsertInNode( left, right_node->key_[i], right_node->child_[i] );
           }
@@ -873,7 +2485,7 @@ void CAdaptiveRadixTree::MergeChildNodes(CArtNode ** left, CArtNode * right, std
             }
             else
             {
-              MovePrefix( right_node->child_[i], right_suffix_table_ );
+              MovePrefix( &( right_node->child_[i] ), right_suffix_table_ );
               InsertInNode( left, ch, right_node->child_[i] );  // insert unique child in current left node as child.
             }
           }
@@ -888,24 +2500,20 @@ void CAdaptiveRadixTree::MergeChildNodes(CArtNode ** left, CArtNode * right, std
 
       if ( right_node->children_count_ )
       {
-        for ( int i = 0; i < 256; ++i )
-        {
-          if ( right_node->child_index_[i] != CArtNode48::EMPTY_MARKER )
+        detail::Helper::ForEachPresent( right_node->present_, [&]( uint8_t i ) {
+          CArtNode ** left_child = FindChild(*left, (char)i );
+          // if child exists we will continue to match its content with remaining key.
+          if ( left_child )
           {
-            CArtNode ** left_child = FindChild(*left, (char)i );
-            // if child exists we will continue to match its content with remaining key.
-            if ( left_child )
-            {
-              Merge( left_child, &( right_node->child_[right_node->child_index_[i]] ), right_suffix_table_ );
-            }
-            else
-            {
-              MovePrefix( right_node->child_[right_node->child_index_[i]], right_suffix_table_ );
-              // insert unique child in current left node as child.
-              InsertInNode( left, i, right_node->child_[right_node->child_index_[i]] );
-            }
+            Merge( left_child, &( right_node->child_[right_node->child_index_[i]] ), right_suffix_table_ );
           }
-        }
+          else
+          {
+            MovePrefix( &( right_node->child_[right_node->child_index_[i]] ), right_suffix_table_ );
+            // insert unique child in current left node as child.
+            InsertInNode( left, i, right_node->child_[right_node->child_index_[i]] );
+          }
+        } );
       }
     }
     break;
@@ -916,24 +2524,20 @@ void CAdaptiveRadixTree::MergeChildNodes(CArtNode ** left, CArtNode * right, std
 
       if ( right_node->children_count_ )
       {
-        for ( int i = 0; i < 256; ++i )
-        {
-          if ( right_node->child_[i] != CArtNode256::EMPTY_NODE )  //< node is different than empty node
+        detail::Helper::ForEachPresent( right_node->present_, [&]( uint8_t i ) {
+          CArtNode ** left_child = FindChild(*left, (char)i );
+          // if child exists we will continue to match its content with remaining key.
+          if ( left_child )
           {
-            CArtNode ** left_child = FindChild(*left, (char)i );
-            // if child exists we will continue to match its content with remaining key.
-            if ( left_child )
-            {
-              Merge( left_child, &( right_node->child_[i] ), right_suffix_table_ );
-            }
-            else
-            {
-              MovePrefix( right_node->child_[i], right_suffix_table_ );
-              // insert unique child in current left node as child.
-              InsertInNode( left, (char)i, right_node->child_[i] );
-            }
+            Merge( left_child, &( right_node->child_[i] ), right_suffix_table_ );
           }
-        }
+          else
+          {
+            MovePrefix( &( right_node->child_[i] ), right_suffix_table_ );
+            // insert unique child in current left node as child.
+            InsertInNode( left, (char)i, right_node->child_[i] );
+          }
+        } );
       }
     }
     break;
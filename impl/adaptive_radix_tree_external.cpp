@@ -0,0 +1,423 @@
+#include "adaptive_radix_tree_external.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <functional>
+#include <queue>
+#include <stdexcept>
+#include <system_error>
+
+#include <unistd.h>
+
+#include "utils.hpp"
+
+namespace
+{
+/// Entries passed to AddEntries at once when building a tree from runs.
+const size_t BUILD_BATCH_SIZE = 4096;
+
+/// First words of a run, "ARTR" when read in little endian byte order.
+const uint32_t RUN_MAGIC = 0x52545241;
+const uint32_t RUN_VERSION = 1;
+
+void WriteBytes( FILE* file, const void* data, size_t size )
+{
+  if ( size && fwrite( data, 1, size, file ) != size )
+  {
+    throw std::system_error( errno, std::generic_category(), "writing ART run" );
+  }
+}
+
+void WriteUint32( FILE* file, size_t value )
+{
+  const uint32_t value32 = static_cast<uint32_t>( value );
+  WriteBytes( file, &value32, sizeof( value32 ) );
+}
+
+/// Returns false if file ends before the first byte, throws if it ends after it.
+bool ReadBytes( FILE* file, void* data, size_t size )
+{
+  const size_t read = fread( data, 1, size, file );
+  if ( read == size )
+  {
+    return true;
+  }
+  if ( ferror( file ) )
+  {
+    throw std::system_error( errno, std::generic_category(), "reading ART run" );
+  }
+  if ( read )
+  {
+    throw std::runtime_error( "truncated ART run" );
+  }
+  return false;
+}
+
+uint32_t ReadUint32( FILE* file )
+{
+  uint32_t value;
+  if ( !ReadBytes( file, &value, sizeof( value ) ) )
+  {
+    throw std::runtime_error( "truncated ART run" );
+  }
+  return value;
+}
+
+void ReadRows( FILE* file, std::vector<uint32_t> & rows )
+{
+  rows.resize( ReadUint32( file ) );
+  if ( !rows.empty() && !ReadBytes( file, rows.data(), rows.size() * sizeof( uint32_t ) ) )
+  {
+    throw std::runtime_error( "truncated ART run" );
+  }
+}
+
+void WriteRows( FILE* file, const std::vector<uint32_t> & rows )
+{
+  WriteUint32( file, rows.size() );
+  WriteBytes( file, rows.data(), rows.size() * sizeof( uint32_t ) );
+}
+
+void WriteHeader( FILE* file, uint32_t row_count )
+{
+  WriteUint32( file, RUN_MAGIC );
+  WriteUint32( file, RUN_VERSION );
+  WriteUint32( file, row_count );
+}
+}
+
+/// Reads records of a run one after another.
+class CArtExternalBuilder::CRunReader
+{
+public:
+  /// Reads run header from the beginning of file, throws std::runtime_error if it isn't one of this version.
+  explicit CRunReader( FILE* file )
+      : file_( file )
+  {
+    rewind( file_ );
+    uint32_t magic;
+    if ( !ReadBytes( file_, &magic, sizeof( magic ) ) || magic != RUN_MAGIC )
+    {
+      throw std::runtime_error( "not an ART run" );
+    }
+    const uint32_t version = ReadUint32( file_ );
+    if ( version != RUN_VERSION )
+    {
+      throw std::runtime_error( "unsupported ART run version " + std::to_string( version ) );
+    }
+    row_count_ = ReadUint32( file_ );
+    ReadRows( file_, null_rows_ );
+  }
+
+  /// Reads next record into key_ and rows_, returns false at the end of run.
+  bool Next()
+  {
+    uint32_t key_length;
+    if ( !ReadBytes( file_, &key_length, sizeof( key_length ) ) )
+    {
+      return false;
+    }
+    key_.resize( key_length );
+    if ( key_length && !ReadBytes( file_, &key_[0], key_length ) )
+    {
+      throw std::runtime_error( "truncated ART run" );
+    }
+    ReadRows( file_, rows_ );
+    return true;
+  }
+
+  FILE* file_;
+  uint32_t row_count_;
+  std::vector<uint32_t> null_rows_;
+  std::string key_;
+  std::vector<uint32_t> rows_;
+};
+
+const size_t CArtExternalBuilder::MAX_RUN_COUNT;
+
+CArtExternalBuilder::CArtExternalBuilder( size_t memory_budget, const std::string & directory )
+    : memory_budget_( memory_budget ),
+      directory_( directory ),
+      tree_( new CAdaptiveRadixTree( 0 ) )
+{
+}
+
+CArtExternalBuilder::~CArtExternalBuilder()
+{
+  Clear();
+}
+
+void CArtExternalBuilder::Clear()
+{
+  for ( FILE* run : runs_ )
+  {
+    fclose( run );
+  }
+  runs_.clear();
+  tree_.reset( new CAdaptiveRadixTree( 0 ) );
+  row_count_ = 0;
+}
+
+void CArtExternalBuilder::AddEntry( const char* key, size_t key_length, uint32_t value )
+{
+  assert( value < CArtNode::LAST_INDEX_IDENTIFIER );
+  if ( value >= tree_->GetIndexVectorLength() )
+  {
+    tree_->Resize( std::max<size_t>( value + 1, 2 * tree_->GetIndexVectorLength() ) );
+  }
+  row_count_ = std::max( row_count_, value + 1 );
+
+  tree_->AddEntry( key, key_length, value );
+  if ( tree_->GetMemoryUsage() > memory_budget_ )
+  {
+    Spill();
+  }
+}
+
+void CArtExternalBuilder::AddNullString( uint32_t value )
+{
+  assert( value < CArtNode::LAST_INDEX_IDENTIFIER );
+  if ( value >= tree_->GetIndexVectorLength() )
+  {
+    tree_->Resize( std::max<size_t>( value + 1, 2 * tree_->GetIndexVectorLength() ) );
+  }
+  row_count_ = std::max( row_count_, value + 1 );
+  tree_->AddNullString( value );
+}
+
+FILE* CArtExternalBuilder::CreateRun() const
+{
+  const std::string path_template = directory_ + "/artrunXXXXXX";
+  std::vector<char> path( path_template.begin(), path_template.end() );
+  path.push_back( '\0' );
+  int fd = mkstemp( path.data() );
+  if ( fd < 0 )
+  {
+    throw std::system_error( errno, std::generic_category(), path_template );
+  }
+  unlink( path.data() );
+  FILE* run = fdopen( fd, "w+b" );
+  if ( !run )
+  {
+    int error = errno;
+    close( fd );
+    throw std::system_error( error, std::generic_category(), path_template );
+  }
+  return run;
+}
+
+void CArtExternalBuilder::Spill()
+{
+  if ( runs_.size() >= MAX_RUN_COUNT )
+  {
+    FILE* merged = CreateRun();
+    try
+    {
+      MergeInto( runs_, row_count_, merged );
+    }
+    catch ( ... )
+    {
+      fclose( merged );
+      throw;
+    }
+    for ( FILE* run : runs_ )
+    {
+      fclose( run );
+    }
+    runs_.assign( 1, merged );
+  }
+
+  FILE* run = CreateRun();
+  runs_.push_back( run );
+
+  WriteHeader( run, row_count_ );
+  WriteRows( run, std::vector<uint32_t>( tree_->GetNullStringBegin(), tree_->GetNullStringEnd() ) );
+  std::vector<uint32_t> rows;
+  tree_->ForEachKey( [&]( const char* key, size_t key_length, CIndexIterator begin, CIndexIterator end ) {
+    rows.assign( begin, end );
+    WriteUint32( run, key_length );
+    WriteBytes( run, key, key_length );
+    WriteRows( run, rows );
+  } );
+  if ( fflush( run ) != 0 )
+  {
+    throw std::system_error( errno, std::generic_category(), "writing ART run" );
+  }
+
+  tree_->Reset();
+}
+
+template <typename NullFunction, typename Function>
+uint32_t CArtExternalBuilder::Merge( const std::vector<FILE*> & runs, NullFunction null_function, Function function )
+{
+  std::vector<CRunReader> readers;
+  uint32_t row_count = 0;
+  std::vector<uint32_t> rows;
+  for ( FILE* run : runs )
+  {
+    readers.emplace_back( run );
+    row_count = std::max( row_count, readers.back().row_count_ );
+    rows.insert( rows.end(), readers.back().null_rows_.begin(), readers.back().null_rows_.end() );
+  }
+  null_function( rows );
+
+  // min heap of readers by current key.
+  auto greater = [&]( size_t left, size_t right ) { return readers[left].key_ > readers[right].key_; };
+  std::priority_queue<size_t, std::vector<size_t>, decltype( greater )> heap( greater );
+  for ( size_t i = 0; i < readers.size(); ++i )
+  {
+    if ( readers[i].Next() )
+    {
+      heap.push( i );
+    }
+  }
+
+  std::string key;
+  while ( !heap.empty() )
+  {
+    size_t reader = heap.top();
+    heap.pop();
+    key.swap( readers[reader].key_ );
+    rows.swap( readers[reader].rows_ );
+    if ( readers[reader].Next() )
+    {
+      heap.push( reader );
+    }
+
+    // runs are disjoint in rows but not in keys.
+    while ( !heap.empty() && readers[heap.top()].key_ == key )
+    {
+      reader = heap.top();
+      heap.pop();
+      rows.insert( rows.end(), readers[reader].rows_.begin(), readers[reader].rows_.end() );
+      if ( readers[reader].Next() )
+      {
+        heap.push( reader );
+      }
+    }
+    function( key, rows );
+  }
+  return row_count;
+}
+
+void CArtExternalBuilder::MergeInto( const std::vector<FILE*> & runs, uint32_t row_count, FILE* file )
+{
+  WriteHeader( file, row_count );
+  Merge( runs, [&]( const std::vector<uint32_t> & rows ) { WriteRows( file, rows ); },
+         [&]( const std::string & key, const std::vector<uint32_t> & rows ) {
+           WriteUint32( file, key.size() );
+           WriteBytes( file, key.data(), key.size() );
+           WriteRows( file, rows );
+         } );
+  if ( fflush( file ) != 0 )
+  {
+    throw std::system_error( errno, std::generic_category(), "writing ART run" );
+  }
+}
+
+std::unique_ptr<CAdaptiveRadixTree> CArtExternalBuilder::BuildTree( const std::vector<FILE*> & runs )
+{
+  auto result = std::make_unique<CAdaptiveRadixTree>( 0 );
+
+  // keys come sorted, so AddEntries resumes each insertion from the previous one.
+  std::string bytes;
+  std::vector<size_t> offsets, key_lengths;
+  std::vector<uint32_t> values;
+  std::vector<const char*> keys;
+  auto flush = [&]() {
+    keys.clear();
+    for ( size_t offset : offsets )
+    {
+      keys.push_back( bytes.data() + offset );
+    }
+    result->AddEntries( keys.data(), key_lengths.data(), values.data(), values.size() );
+    bytes.clear();
+    offsets.clear();
+    key_lengths.clear();
+    values.clear();
+  };
+
+  // rows may exceed the index vector until the row count is known at the end of the merge.
+  auto reserve = [&]( const std::vector<uint32_t> & rows ) {
+    const uint32_t row_count = rows.empty() ? 0 : *std::max_element( rows.begin(), rows.end() ) + 1;
+    if ( row_count > result->GetIndexVectorLength() )
+    {
+      result->Resize( std::max<size_t>( row_count, 2 * result->GetIndexVectorLength() ) );
+    }
+  };
+
+  const uint32_t row_count = Merge( runs,
+                                    [&]( const std::vector<uint32_t> & rows ) {
+                                      reserve( rows );
+                                      for ( uint32_t row : rows )
+                                      {
+                                        result->AddNullString( row );
+                                      }
+                                    },
+                                    [&]( const std::string & key, const std::vector<uint32_t> & rows ) {
+                                      reserve( rows );
+                                      offsets.push_back( bytes.size() );
+                                      bytes.append( key );
+                                      key_lengths.push_back( key.size() );
+                                      values.push_back( rows[0] );
+                                      for ( size_t i = 1; i < rows.size(); ++i )
+                                      {
+                                        offsets.push_back( offsets.back() );
+                                        key_lengths.push_back( key.size() );
+                                        values.push_back( rows[i] );
+                                      }
+                                      if ( values.size() >= BUILD_BATCH_SIZE )
+                                      {
+                                        flush();
+                                      }
+                                    } );
+  flush();
+  result->Resize( row_count );
+  return result;
+}
+
+std::unique_ptr<CAdaptiveRadixTree> CArtExternalBuilder::Build()
+{
+  std::unique_ptr<CAdaptiveRadixTree> result;
+  if ( runs_.empty() )
+  {
+    tree_->Resize( row_count_ );
+    result = std::move( tree_ );
+  }
+  else
+  {
+    Spill();
+    result = BuildTree( runs_ );
+  }
+  Clear();
+  return result;
+}
+
+void CArtExternalBuilder::Write( const std::string & path )
+{
+  FILE* file = fopen( path.c_str(), "wb" );
+  if ( !file )
+  {
+    throw std::system_error( errno, std::generic_category(), path );
+  }
+  std::unique_ptr<FILE, int ( * )( FILE* )> guard( file, fclose );
+
+  Spill();
+  MergeInto( runs_, row_count_, file );
+  if ( fclose( guard.release() ) != 0 )
+  {
+    throw std::system_error( errno, std::generic_category(), path );
+  }
+  Clear();
+}
+
+std::unique_ptr<CAdaptiveRadixTree> CArtExternalBuilder::Load( const std::string & path )
+{
+  FILE* file = fopen( path.c_str(), "rb" );
+  if ( !file )
+  {
+    throw std::system_error( errno, std::generic_category(), path );
+  }
+  std::unique_ptr<FILE, int ( * )( FILE* )> guard( file, fclose );
+  return BuildTree( std::vector<FILE*>( 1, file ) );
+}
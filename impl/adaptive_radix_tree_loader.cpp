@@ -0,0 +1,201 @@
+#include "adaptive_radix_tree_loader.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#ifdef __SSE2__
+#include <immintrin.h>
+#endif
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "utils.hpp"
+
+namespace
+{
+/// Calls function( record, length ) for each record in [begin, end).
+/// Delimiters are searched 16 bytes at a time, records of a block are then found from the comparison mask.
+template <typename Function>
+void ForEachRecord( const char* begin, const char* end, char delimiter, Function function )
+{
+  const char* record = begin;
+  const char* position = begin;
+
+#ifdef __SSE2__
+  const __m128i delimiters = _mm_set1_epi8( delimiter );
+  for ( ; end - position >= 16; position += 16 )
+  {
+    unsigned mask = _mm_movemask_epi8(
+        _mm_cmpeq_epi8( _mm_loadu_si128( reinterpret_cast<const __m128i*>( position ) ), delimiters ) );
+    for ( ; mask; mask &= mask - 1 )
+    {
+      const char* record_end = position + detail::Helper::ctz( mask );
+      function( record, static_cast<size_t>( record_end - record ) );
+      record = record_end + 1;
+    }
+  }
+#endif
+
+  for ( ; position < end; ++position )
+  {
+    if ( *position == delimiter )
+    {
+      function( record, static_cast<size_t>( position - record ) );
+      record = position + 1;
+    }
+  }
+
+  if ( record < end )
+  {
+    function( record, static_cast<size_t>( end - record ) );
+  }
+}
+
+/// Runs function( i ) for i in [0, count), each on its own thread; first one runs on calling thread.
+template <typename Function>
+void RunParallel( unsigned count, Function function )
+{
+  std::vector<std::thread> workers;
+  for ( unsigned i = 1; i < count; ++i )
+  {
+    workers.emplace_back( function, i );
+  }
+  function( 0 );
+  for ( auto& worker : workers )
+  {
+    worker.join();
+  }
+}
+}
+
+CArtFileLoader::CArtFileLoader( const std::string& path )
+{
+  int fd = open( path.c_str(), O_RDONLY );
+  if ( fd < 0 )
+  {
+    throw std::system_error( errno, std::generic_category(), path );
+  }
+
+  struct stat status;
+  if ( fstat( fd, &status ) != 0 )
+  {
+    int error = errno;
+    close( fd );
+    throw std::system_error( error, std::generic_category(), path );
+  }
+
+  size_ = static_cast<size_t>( status.st_size );
+  if ( size_ )
+  {
+    void* mapping = mmap( nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0 );
+    if ( mapping == MAP_FAILED )
+    {
+      int error = errno;
+      close( fd );
+      throw std::system_error( error, std::generic_category(), path );
+    }
+    madvise( mapping, size_, MADV_SEQUENTIAL );
+    data_ = static_cast<const char*>( mapping );
+  }
+  close( fd );
+}
+
+CArtFileLoader::~CArtFileLoader()
+{
+  if ( data_ )
+  {
+    munmap( const_cast<char*>( data_ ), size_ );
+  }
+}
+
+size_t CArtFileLoader::CountRecords( const char* begin, const char* end, char delimiter )
+{
+  size_t count = 0;
+  const char* position = begin;
+
+#ifdef __SSE2__
+  const __m128i delimiters = _mm_set1_epi8( delimiter );
+  for ( ; end - position >= 16; position += 16 )
+  {
+    unsigned mask = _mm_movemask_epi8(
+        _mm_cmpeq_epi8( _mm_loadu_si128( reinterpret_cast<const __m128i*>( position ) ), delimiters ) );
+    count += detail::Helper::popcount64( mask );
+  }
+#endif
+
+  count += std::count( position, end, delimiter );
+
+  // last record may not be terminated.
+  if ( begin < end && end[-1] != delimiter )
+  {
+    ++count;
+  }
+  return count;
+}
+
+std::unique_ptr<CAdaptiveRadixTree> CArtFileLoader::Build( char delimiter, unsigned threads ) const
+{
+  threads = std::max( threads, 1u );
+  const char* end = data_ + size_;
+
+  // cut input into parts at record boundaries.
+  std::vector<const char*> bounds( 1, data_ );
+  for ( unsigned i = 1; i < threads; ++i )
+  {
+    const char* bound = std::max( bounds.back(), data_ + size_ / threads * i );
+    bound = bound < end ? static_cast<const char*>( memchr( bound, delimiter, end - bound ) ) : nullptr;
+    bounds.push_back( bound ? bound + 1 : end );
+  }
+  bounds.push_back( end );
+
+  std::vector<size_t> first_rows( threads + 1, 0 );
+  RunParallel( threads, [&]( unsigned i ) { first_rows[i + 1] = CountRecords( bounds[i], bounds[i + 1], delimiter ); } );
+  for ( unsigned i = 0; i < threads; ++i )
+  {
+    first_rows[i + 1] += first_rows[i];
+  }
+
+  if ( first_rows[threads] >= CArtNode::LAST_INDEX_IDENTIFIER )
+  {
+    throw std::length_error( "too many records for a CAdaptiveRadixTree" );
+  }
+
+  auto result = std::make_unique<CAdaptiveRadixTree>( static_cast<uint32_t>( first_rows[threads] ) );
+
+  std::vector<std::unique_ptr<CAdaptiveRadixTree>> parts;
+  for ( unsigned i = 1; i < threads; ++i )
+  {
+    parts.push_back( result->Split() );
+  }
+
+  RunParallel( threads, [&]( unsigned i ) {
+    CAdaptiveRadixTree& tree = i ? *parts[i - 1] : *result;
+    uint32_t row = static_cast<uint32_t>( first_rows[i] );
+    ForEachRecord( bounds[i], bounds[i + 1], delimiter, [&]( const char* record, size_t length ) {
+      if ( length )
+      {
+        tree.AddEntry( record, length, row++ );
+      }
+      else
+      {
+        tree.AddNullString( row++ );
+      }
+    } );
+  } );
+
+  std::vector<CAdaptiveRadixTree*> others;
+  for ( auto& part : parts )
+  {
+    others.push_back( part.get() );
+  }
+  result->JoinMany( others );
+  return result;
+}
@@ -0,0 +1,195 @@
+#include "adaptive_radix_tree_memory.hpp"
+
+#include <cassert>
+#include <new>
+
+#if defined( __unix__ ) || defined( __APPLE__ )
+#define ART_HAVE_MMAP 1
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+namespace
+{
+// From linux/mempolicy.h, which is not always installed; numaif.h belongs to libnuma which we don't link.
+const int MPOL_PREFERRED_MODE = 1;
+const int MPOL_INTERLEAVE_MODE = 3;
+const unsigned long MPOL_F_MEMS_ALLOWED_FLAG = 1 << 2;
+
+/// Room for 1024 NUMA nodes, which is the kernel maximum for usual configurations.
+const unsigned long MAX_NUMA_NODES = 1024;
+
+/// Blocks are aligned for pointers, which is what nodes need.
+const size_t BLOCK_ALIGNMENT = alignof( void* );
+
+size_t AlignBlockSize( size_t size )
+{
+  return ( size + BLOCK_ALIGNMENT - 1 ) & ~( BLOCK_ALIGNMENT - 1 );
+}
+
+/// First chunk bytes are reserved for CChunkHeader, keeping nodes cache line aligned at chunk start.
+const size_t CHUNK_HEADER_SIZE = 64;
+}
+
+bool CArtMemoryPolicy::Apply( void* address, size_t length ) const
+{
+#ifndef ART_HAVE_MMAP
+  ( void )address;
+  ( void )length;
+  return page_size_ == DefaultPages && placement_ == DefaultPlacement;
+#else
+  const uintptr_t page_size = static_cast<uintptr_t>( sysconf( _SC_PAGESIZE ) );
+  uintptr_t begin = ( reinterpret_cast<uintptr_t>( address ) + page_size - 1 ) & ~( page_size - 1 );
+  uintptr_t end = ( reinterpret_cast<uintptr_t>( address ) + length ) & ~( page_size - 1 );
+  if ( begin >= end )
+  {
+    return true;
+  }
+
+  bool result = true;
+  if ( page_size_ != DefaultPages )
+  {
+#ifdef MADV_HUGEPAGE
+    result = madvise( reinterpret_cast<void*>( begin ), end - begin, MADV_HUGEPAGE ) == 0;
+#else
+    result = false;
+#endif
+  }
+
+  if ( placement_ != DefaultPlacement )
+  {
+#if defined( __linux__ ) && defined( SYS_mbind ) && defined( SYS_get_mempolicy )
+    unsigned long nodes[MAX_NUMA_NODES / ( 8 * sizeof( unsigned long ) )] = {};
+    int mode = MPOL_PREFERRED_MODE;  // preferred with no nodes means the local node.
+    if ( placement_ == InterleavedPlacement )
+    {
+      mode = MPOL_INTERLEAVE_MODE;
+      int current_mode;
+      if ( syscall( SYS_get_mempolicy, &current_mode, nodes, MAX_NUMA_NODES, nullptr, MPOL_F_MEMS_ALLOWED_FLAG ) != 0 )
+      {
+        return false;
+      }
+    }
+    // kernel reads one bit less than maxnode.
+    result = syscall( SYS_mbind, begin, end - begin, mode, nodes, MAX_NUMA_NODES + 1, 0 ) == 0 && result;
+#else
+    result = false;
+#endif
+  }
+  return result;
+#endif
+}
+
+CArtNodePool::~CArtNodePool()
+{
+  for ( char* chunk : chunks_ )
+  {
+#ifdef ART_HAVE_MMAP
+    munmap( chunk, CHUNK_SIZE );
+#else
+    delete[] static_cast<char*>( reinterpret_cast<CChunkHeader*>( chunk )->allocation_ );
+#endif
+  }
+}
+
+void CArtNodePool::MapChunk()
+{
+  char* chunk = nullptr;
+  void* allocation = nullptr;
+
+#ifndef ART_HAVE_MMAP
+  // twice the chunk size holds an aligned chunk wherever the block starts.
+  allocation = new char[2 * CHUNK_SIZE];
+  chunk = reinterpret_cast<char*>( ( reinterpret_cast<uintptr_t>( allocation ) + CHUNK_SIZE - 1 ) &
+                                   ~static_cast<uintptr_t>( CHUNK_SIZE - 1 ) );
+#else
+#ifdef MAP_HUGETLB
+  if ( policy_.page_size_ == CArtMemoryPolicy::ExplicitHugePages )
+  {
+    // huge page mappings are aligned to the huge page size.
+    void* mapping = mmap( nullptr, CHUNK_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0 );
+    if ( mapping != MAP_FAILED && !( reinterpret_cast<uintptr_t>( mapping ) & ( CHUNK_SIZE - 1 ) ) )
+    {
+      chunk = static_cast<char*>( mapping );
+      CArtMemoryPolicy( CArtMemoryPolicy::DefaultPages, policy_.placement_ ).Apply( chunk, CHUNK_SIZE );
+    }
+    else if ( mapping != MAP_FAILED )
+    {
+      munmap( mapping, CHUNK_SIZE );
+    }
+  }
+#endif
+
+  if ( !chunk )
+  {
+    // map twice the chunk size and unmap the parts around the aligned chunk.
+    void* mapping = mmap( nullptr, 2 * CHUNK_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+    if ( mapping == MAP_FAILED )
+    {
+      throw std::bad_alloc();
+    }
+
+    char* begin = static_cast<char*>( mapping );
+    chunk = reinterpret_cast<char*>( ( reinterpret_cast<uintptr_t>( begin ) + CHUNK_SIZE - 1 ) &
+                                     ~static_cast<uintptr_t>( CHUNK_SIZE - 1 ) );
+    if ( chunk != begin )
+    {
+      munmap( begin, chunk - begin );
+    }
+    munmap( chunk + CHUNK_SIZE, begin + CHUNK_SIZE - chunk );
+    policy_.Apply( chunk, CHUNK_SIZE );
+  }
+#endif
+
+  reinterpret_cast<CChunkHeader*>( chunk )->pool_ = this;
+  reinterpret_cast<CChunkHeader*>( chunk )->allocation_ = allocation;
+  chunks_.push_back( chunk );
+  free_begin_ = chunk + CHUNK_HEADER_SIZE;
+  free_end_ = chunk + CHUNK_SIZE;
+}
+
+void* CArtNodePool::Allocate( size_t size, unsigned size_class )
+{
+  size = AlignBlockSize( size );
+  assert( size <= CHUNK_SIZE - CHUNK_HEADER_SIZE && size_class < SIZE_CLASS_COUNT );
+
+  void*& free_list = free_lists_[size_class];
+  if ( !free_list && released_lists_[size_class].load( std::memory_order_relaxed ) )
+  {
+    free_list = released_lists_[size_class].exchange( nullptr, std::memory_order_acquire );
+  }
+  if ( free_list )
+  {
+    void* block = free_list;
+    free_list = *static_cast<void**>( block );
+    return block;
+  }
+
+  if ( static_cast<size_t>( free_end_ - free_begin_ ) < size )
+  {
+    MapChunk();
+  }
+  void* block = free_begin_;
+  free_begin_ += size;
+  return block;
+}
+
+void CArtNodePool::Release( void* block, unsigned size_class )
+{
+  assert( size_class < SIZE_CLASS_COUNT );
+  char* chunk =
+      reinterpret_cast<char*>( reinterpret_cast<uintptr_t>( block ) & ~static_cast<uintptr_t>( CHUNK_SIZE - 1 ) );
+  CArtNodePool* pool = reinterpret_cast<CChunkHeader*>( chunk )->pool_;
+
+  // only pushed to, Allocate takes the whole list with exchange, so there is no ABA problem.
+  std::atomic<void*>& released = pool->released_lists_[size_class];
+  void* head = released.load( std::memory_order_relaxed );
+  do
+  {
+    *static_cast<void**>( block ) = head;
+  } while ( !released.compare_exchange_weak( head, block, std::memory_order_release, std::memory_order_relaxed ) );
+}
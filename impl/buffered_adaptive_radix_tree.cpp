@@ -0,0 +1,180 @@
+#include "buffered_adaptive_radix_tree.hpp"
+
+#include <algorithm>
+
+CBufferedAdaptiveRadixTree::CBufferedAdaptiveRadixTree( uint32_t max_index_count, size_t merge_threshold )
+    : merge_threshold_( std::max<size_t>( merge_threshold, 1 ) ),
+      main_( new CAdaptiveRadixTree( max_index_count ) )
+{
+  Start();
+}
+
+CBufferedAdaptiveRadixTree::CBufferedAdaptiveRadixTree( std::unique_ptr<CAdaptiveRadixTree> main,
+                                                        size_t merge_threshold )
+    : merge_threshold_( std::max<size_t>( merge_threshold, 1 ) ),
+      main_( std::move( main ) )
+{
+  Start();
+}
+
+CBufferedAdaptiveRadixTree::~CBufferedAdaptiveRadixTree()
+{
+  Stop();
+}
+
+void CBufferedAdaptiveRadixTree::Start()
+{
+  buffer_ = main_->Split();
+  merger_ = std::thread( &CBufferedAdaptiveRadixTree::Run, this );
+}
+
+void CBufferedAdaptiveRadixTree::Stop()
+{
+  {
+    std::lock_guard<std::mutex> lock( buffer_mutex_ );
+    stop_ = true;
+  }
+  merge_needed_.notify_one();
+  if ( merger_.joinable() )
+  {
+    merger_.join();
+  }
+}
+
+void CBufferedAdaptiveRadixTree::AddEntry( const char* key, size_t key_length, uint32_t value )
+{
+  std::unique_lock<std::mutex> lock( buffer_mutex_ );
+  buffer_->AddEntry( key, key_length, value );
+  if ( ++buffered_count_ == merge_threshold_ )
+  {
+    lock.unlock();
+    merge_needed_.notify_one();
+  }
+}
+
+void CBufferedAdaptiveRadixTree::AddNullString( uint32_t value )
+{
+  std::unique_lock<std::mutex> lock( buffer_mutex_ );
+  buffer_->AddNullString( value );
+  if ( ++buffered_count_ == merge_threshold_ )
+  {
+    lock.unlock();
+    merge_needed_.notify_one();
+  }
+}
+
+void CBufferedAdaptiveRadixTree::Run()
+{
+  std::unique_lock<std::mutex> lock( buffer_mutex_ );
+  for ( ;; )
+  {
+    merge_needed_.wait( lock, [this]() { return stop_ || buffered_count_ >= merge_threshold_; } );
+    if ( stop_ )
+    {
+      return;
+    }
+    lock.unlock();
+    Merge();
+    lock.lock();
+  }
+}
+
+void CBufferedAdaptiveRadixTree::Merge()
+{
+  std::lock_guard<std::mutex> merge_lock( merge_mutex_ );
+  {
+    std::lock_guard<std::mutex> lock( buffer_mutex_ );
+    if ( !buffered_count_ )
+    {
+      return;
+    }
+    // full buffer isn't written anymore, so new buffer can be split from it while main tree is read.
+    merging_ = std::move( buffer_ );
+    buffer_ = merging_->Split();
+    buffered_count_ = 0;
+  }
+
+  std::lock_guard<std::mutex> main_lock( main_mutex_ );
+  main_->Join( *merging_ );
+  ++merge_count_;
+  std::lock_guard<std::mutex> lock( buffer_mutex_ );
+  merging_.reset();
+}
+
+void CBufferedAdaptiveRadixTree::Flush()
+{
+  Merge();
+}
+
+std::unique_ptr<CAdaptiveRadixTree> CBufferedAdaptiveRadixTree::Release()
+{
+  Stop();
+  Merge();
+  return std::move( main_ );
+}
+
+size_t CBufferedAdaptiveRadixTree::GetMergeCount() const
+{
+  std::lock_guard<std::mutex> lock( main_mutex_ );
+  return merge_count_;
+}
+
+template <typename Scan>
+size_t CBufferedAdaptiveRadixTree::ScanAll( CRowSelection & selection, Scan scan ) const
+{
+  std::lock_guard<std::mutex> main_lock( main_mutex_ );
+  std::lock_guard<std::mutex> lock( buffer_mutex_ );
+
+  const CRowSelection::Mode mode = selection.GetMode();
+  size_t count = scan( *main_, selection );
+  selection.SetMode( CRowSelection::Or );
+  if ( merging_ )
+  {
+    count += scan( *merging_, selection );
+  }
+  count += scan( *buffer_, selection );
+  selection.SetMode( mode );
+  return count;
+}
+
+size_t CBufferedAdaptiveRadixTree::ScanPoint( const char* key, size_t key_length, CRowSelection & selection ) const
+{
+  return ScanAll( selection, [&]( const CAdaptiveRadixTree & tree, CRowSelection & tree_selection ) {
+    return tree.ScanPoint( key, key_length, tree_selection );
+  } );
+}
+
+size_t CBufferedAdaptiveRadixTree::ScanRange( const char* low, size_t low_length, const char* high,
+                                              size_t high_length, CRowSelection & selection ) const
+{
+  return ScanAll( selection, [&]( const CAdaptiveRadixTree & tree, CRowSelection & tree_selection ) {
+    return tree.ScanRange( low, low_length, high, high_length, tree_selection );
+  } );
+}
+
+size_t CBufferedAdaptiveRadixTree::ScanPrefix( const char* prefix, size_t prefix_length,
+                                               CRowSelection & selection ) const
+{
+  return ScanAll( selection, [&]( const CAdaptiveRadixTree & tree, CRowSelection & tree_selection ) {
+    return tree.ScanPrefix( prefix, prefix_length, tree_selection );
+  } );
+}
+
+size_t CBufferedAdaptiveRadixTree::ScanNull( CRowSelection & selection ) const
+{
+  return ScanAll( selection, [&]( const CAdaptiveRadixTree & tree, CRowSelection & tree_selection ) {
+    return tree.ScanNull( tree_selection );
+  } );
+}
+
+void CBufferedAdaptiveRadixTree::TraverseIndexes( CIndexActionBase & action ) const
+{
+  std::lock_guard<std::mutex> main_lock( main_mutex_ );
+  std::lock_guard<std::mutex> lock( buffer_mutex_ );
+  main_->TraverseIndexes( action );
+  if ( merging_ )
+  {
+    merging_->TraverseIndexes( action );
+  }
+  buffer_->TraverseIndexes( action );
+}
@@ -0,0 +1,302 @@
+#include "pattern_adaptive_radix_tree.hpp"
+
+#include <algorithm>
+#include <iterator>
+#include <utility>
+
+namespace
+{
+const size_t GRAM_LENGTH = 3;
+
+/// Returns whether key matches LIKE pattern, backtracking to the last any_string only.
+bool Like( const char* key, size_t key_length, const char* pattern, size_t pattern_length, char any_string,
+           char any_char )
+{
+  size_t k = 0, p = 0;
+  size_t star = pattern_length, star_key = 0;  //< position of last any_string and of key where it started.
+  while ( k < key_length )
+  {
+    if ( p < pattern_length && pattern[p] == any_string )
+    {
+      star = p++;
+      star_key = k;
+    }
+    else if ( p < pattern_length && ( pattern[p] == any_char || pattern[p] == key[k] ) )
+    {
+      ++p;
+      ++k;
+    }
+    else if ( star != pattern_length )
+    {
+      p = star + 1;
+      k = ++star_key;
+    }
+    else
+    {
+      return false;
+    }
+  }
+  while ( p < pattern_length && pattern[p] == any_string )
+  {
+    ++p;
+  }
+  return p == pattern_length;
+}
+
+/// Collects tuples of reversed keys, to be handed on in key order.
+class CReversedCollector final : public CActionBase
+{
+public:
+  void HandleNode( const CArtNode*, const std::string&, uint32_t ) override
+  {
+  }
+
+  void HandleTuple( const std::string& key, CIndexIterator begin, CIndexIterator end ) override
+  {
+    tuples_.emplace_back( std::string( key.rbegin(), key.rend() ), std::make_pair( begin, end ) );
+  }
+
+  std::vector<std::pair<std::string, std::pair<CIndexIterator, CIndexIterator>>> tuples_;
+};
+
+/// Resizes index vector of tree so that row fits, doubling it at least.
+void ReserveRow( CAdaptiveRadixTree & tree, size_t row )
+{
+  if ( row >= tree.GetIndexVectorLength() )
+  {
+    tree.Resize( std::max( row + 1, 2 * tree.GetIndexVectorLength() ) );
+  }
+}
+}
+
+CPatternAdaptiveRadixTree::CPatternAdaptiveRadixTree( uint32_t max_index_count, unsigned companions )
+    : tree_( new CAdaptiveRadixTree( max_index_count ) )
+{
+  if ( companions & ReverseKeys )
+  {
+    reverse_tree_.reset( new CAdaptiveRadixTree( max_index_count ) );
+  }
+  if ( companions & Trigrams )
+  {
+    trigram_tree_.reset( new CAdaptiveRadixTree( 0 ) );
+  }
+}
+
+CPatternAdaptiveRadixTree::CPatternAdaptiveRadixTree( std::unique_ptr<CAdaptiveRadixTree> tree,
+                                                      std::unique_ptr<CAdaptiveRadixTree> reverse_tree,
+                                                      bool trigrams )
+    : tree_( std::move( tree ) ),
+      reverse_tree_( std::move( reverse_tree ) )
+{
+  if ( trigrams )
+  {
+    trigram_tree_.reset( new CAdaptiveRadixTree( 0 ) );
+  }
+}
+
+void CPatternAdaptiveRadixTree::AddEntry( const char* key, size_t key_length, uint32_t value )
+{
+  const size_t unique_string_count = tree_->GetUniqueStringCount();
+  tree_->AddEntry( key, key_length, value );
+
+  if ( reverse_tree_ )
+  {
+    reversed_key_.assign( std::reverse_iterator<const char*>( key + key_length ),
+                          std::reverse_iterator<const char*>( key ) );
+    reverse_tree_->AddEntry( reversed_key_.data(), reversed_key_.size(), value );
+  }
+
+  if ( trigram_tree_ && tree_->GetUniqueStringCount() != unique_string_count )
+  {
+    AddKey( key, key_length );
+  }
+}
+
+void CPatternAdaptiveRadixTree::AddNullString( uint32_t value )
+{
+  // no pattern matches NULL, so companions don't need it.
+  tree_->AddNullString( value );
+}
+
+void CPatternAdaptiveRadixTree::AddKey( const char* key, size_t key_length )
+{
+  const uint32_t key_index = static_cast<uint32_t>( key_ends_.size() );
+  key_bytes_.append( key, key_length );
+  key_ends_.push_back( key_bytes_.size() );
+
+  // each trigram gets one posting per key, even if it occurs many times in it.
+  std::vector<std::string> grams;
+  for ( size_t i = 0; i + GRAM_LENGTH <= key_length; ++i )
+  {
+    grams.emplace_back( key + i, GRAM_LENGTH );
+  }
+  std::sort( grams.begin(), grams.end() );
+  grams.erase( std::unique( grams.begin(), grams.end() ), grams.end() );
+
+  for ( const std::string& gram : grams )
+  {
+    const uint32_t posting = static_cast<uint32_t>( posting_keys_.size() );
+    posting_keys_.push_back( key_index );
+    ReserveRow( *trigram_tree_, posting );
+    trigram_tree_->AddEntry( gram.data(), gram.size(), posting );
+  }
+}
+
+void CPatternAdaptiveRadixTree::MatchPattern( const char* pattern, size_t pattern_length, CActionBase & action,
+                                              char any_string, char any_char ) const
+{
+  auto literal = [&]( size_t i ) { return pattern[i] != any_string && pattern[i] != any_char; };
+
+  // a literal prefix already restricts the traversal of the tree of keys.
+  if ( !pattern_length || literal( 0 ) )
+  {
+    tree_->MatchPattern( pattern, pattern_length, action, any_string, any_char );
+    return;
+  }
+
+  if ( reverse_tree_ && literal( pattern_length - 1 ) )
+  {
+    MatchReversed( pattern, pattern_length, action, any_string, any_char );
+    return;
+  }
+
+  size_t literal_begin = 0, literal_length = 0;
+  for ( size_t begin = 0, end; begin < pattern_length; begin = end + 1 )
+  {
+    for ( end = begin; end < pattern_length && literal( end ); ++end )
+    {
+    }
+    if ( end - begin > literal_length )
+    {
+      literal_begin = begin;
+      literal_length = end - begin;
+    }
+  }
+
+  if ( trigram_tree_ && literal_length >= GRAM_LENGTH )
+  {
+    MatchCandidates( pattern, pattern_length, pattern + literal_begin, literal_length, action, any_string,
+                     any_char );
+    return;
+  }
+
+  tree_->MatchPattern( pattern, pattern_length, action, any_string, any_char );
+}
+
+void CPatternAdaptiveRadixTree::MatchReversed( const char* pattern, size_t pattern_length, CActionBase & action,
+                                               char any_string, char any_char ) const
+{
+  // LIKE is symmetric, so reversed keys match reversed pattern.
+  const std::string reversed( std::reverse_iterator<const char*>( pattern + pattern_length ),
+                              std::reverse_iterator<const char*>( pattern ) );
+  CReversedCollector collector;
+  reverse_tree_->MatchPattern( reversed.data(), reversed.size(), collector, any_string, any_char );
+
+  std::sort( collector.tuples_.begin(), collector.tuples_.end(),
+             []( const std::pair<std::string, std::pair<CIndexIterator, CIndexIterator>>& left,
+                 const std::pair<std::string, std::pair<CIndexIterator, CIndexIterator>>& right ) {
+               return left.first < right.first;
+             } );
+  for ( auto& tuple : collector.tuples_ )
+  {
+    action.HandleTuple( tuple.first, tuple.second.first, tuple.second.second );
+  }
+}
+
+void CPatternAdaptiveRadixTree::MatchCandidates( const char* pattern, size_t pattern_length, const char* literal,
+                                                 size_t literal_length, CActionBase & action, char any_string,
+                                                 char any_char ) const
+{
+  // candidates are keys having every trigram of the literal.
+  std::vector<uint32_t> candidates, keys, common;
+  for ( size_t i = 0; i + GRAM_LENGTH <= literal_length; ++i )
+  {
+    CIndexIterator begin, end;
+    if ( !trigram_tree_->Find( literal + i, GRAM_LENGTH, begin, end ) )
+    {
+      return;
+    }
+    keys.clear();
+    for ( ; begin != end; ++begin )
+    {
+      keys.push_back( posting_keys_[*begin] );
+    }
+    std::sort( keys.begin(), keys.end() );
+
+    if ( i == 0 )
+    {
+      candidates.swap( keys );
+    }
+    else
+    {
+      common.clear();
+      std::set_intersection( candidates.begin(), candidates.end(), keys.begin(), keys.end(),
+                             std::back_inserter( common ) );
+      candidates.swap( common );
+    }
+    if ( candidates.empty() )
+    {
+      return;
+    }
+  }
+
+  std::vector<std::string> matches;
+  for ( uint32_t candidate : candidates )
+  {
+    const size_t key_begin = candidate ? key_ends_[candidate - 1] : 0;
+    const char* key = key_bytes_.data() + key_begin;
+    const size_t key_length = key_ends_[candidate] - key_begin;
+    if ( Like( key, key_length, pattern, pattern_length, any_string, any_char ) )
+    {
+      matches.emplace_back( key, key_length );
+    }
+  }
+
+  // rows are taken from the tree of keys, in its key order.
+  std::sort( matches.begin(), matches.end() );
+  for ( const std::string& key : matches )
+  {
+    CIndexIterator begin, end;
+    if ( tree_->Find( key.data(), key.size(), begin, end ) )
+    {
+      action.HandleTuple( key, begin, end );
+    }
+  }
+}
+
+std::unique_ptr<CPatternAdaptiveRadixTree> CPatternAdaptiveRadixTree::Split()
+{
+  return std::unique_ptr<CPatternAdaptiveRadixTree>( new CPatternAdaptiveRadixTree(
+      tree_->Split(), reverse_tree_ ? reverse_tree_->Split() : nullptr, trigram_tree_ != nullptr ) );
+}
+
+void CPatternAdaptiveRadixTree::Join( CPatternAdaptiveRadixTree & other )
+{
+  assert( ( reverse_tree_ != nullptr ) == ( other.reverse_tree_ != nullptr ) &&
+          ( trigram_tree_ != nullptr ) == ( other.trigram_tree_ != nullptr ) );
+
+  // trigram postings are numbered per tree, so keys new to this tree are added again.
+  if ( trigram_tree_ )
+  {
+    other.tree_->ForEachKey( [this]( const char* key, size_t key_length, CIndexIterator, CIndexIterator ) {
+      CIndexIterator begin, end;
+      if ( !tree_->Find( key, key_length, begin, end ) )
+      {
+        AddKey( key, key_length );
+      }
+    } );
+  }
+
+  tree_->Join( *other.tree_ );
+  if ( reverse_tree_ )
+  {
+    reverse_tree_->Join( *other.reverse_tree_ );
+  }
+  if ( trigram_tree_ )
+  {
+    other.trigram_tree_.reset( new CAdaptiveRadixTree( 0 ) );
+  }
+  other.posting_keys_.clear();
+  other.key_bytes_.clear();
+  other.key_ends_.clear();
+}
@@ -0,0 +1,156 @@
+#include "sharded_adaptive_radix_tree.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace
+{
+std::vector<uint8_t> EvenShardStarts( unsigned shard_count )
+{
+  shard_count = std::min( std::max( shard_count, 1u ), 256u );
+  std::vector<uint8_t> shard_starts;
+  for ( unsigned i = 1; i < shard_count; ++i )
+  {
+    shard_starts.push_back( static_cast<uint8_t>( i * 256 / shard_count ) );
+  }
+  return shard_starts;
+}
+}
+
+CShardedAdaptiveRadixTree::CShardedAdaptiveRadixTree( uint32_t max_index_count, unsigned shard_count )
+{
+  CreateShards( max_index_count, EvenShardStarts( shard_count ) );
+}
+
+CShardedAdaptiveRadixTree::CShardedAdaptiveRadixTree( uint32_t max_index_count,
+                                                      const std::vector<uint8_t>& shard_starts )
+{
+  CreateShards( max_index_count, shard_starts );
+}
+
+void CShardedAdaptiveRadixTree::CreateShards( uint32_t max_index_count, const std::vector<uint8_t>& shard_starts )
+{
+  for ( size_t i = 0; i < shard_starts.size(); ++i )
+  {
+    if ( shard_starts[i] == 0 || ( i && shard_starts[i] <= shard_starts[i - 1] ) )
+    {
+      throw std::invalid_argument( "shard starts must be positive and strictly increasing" );
+    }
+  }
+
+  shards_.emplace_back( new CShard );
+  shards_[0]->tree_.reset( new CAdaptiveRadixTree( max_index_count ) );
+  for ( size_t i = 0; i < shard_starts.size(); ++i )
+  {
+    shards_.emplace_back( new CShard );
+    shards_.back()->tree_ = shards_[0]->tree_->Split();
+  }
+
+  size_t shard = 0;
+  for ( unsigned byte = 0; byte < 256; ++byte )
+  {
+    if ( shard < shard_starts.size() && byte == shard_starts[shard] )
+    {
+      ++shard;
+    }
+    shard_of_[byte] = static_cast<uint16_t>( shard );
+  }
+}
+
+void CShardedAdaptiveRadixTree::AddEntry( const char* key, size_t key_length, uint32_t value )
+{
+  CShard& shard = *shards_[ShardOf( key, key_length )];
+  std::lock_guard<std::mutex> lock( shard.mutex_ );
+  shard.tree_->AddEntry( key, key_length, value );
+}
+
+void CShardedAdaptiveRadixTree::AddNullString( uint32_t value )
+{
+  CShard& shard = *shards_[0];
+  std::lock_guard<std::mutex> lock( shard.mutex_ );
+  shard.tree_->AddNullString( value );
+}
+
+bool CShardedAdaptiveRadixTree::Find( const char* key, size_t key_length, CIndexIterator& begin,
+                                      CIndexIterator& end ) const
+{
+  const CShard& shard = *shards_[ShardOf( key, key_length )];
+  std::lock_guard<std::mutex> lock( shard.mutex_ );
+  return shard.tree_->Find( key, key_length, begin, end );
+}
+
+void CShardedAdaptiveRadixTree::Traverse( CActionBase& action ) const
+{
+  for ( auto& shard : shards_ )
+  {
+    std::lock_guard<std::mutex> lock( shard->mutex_ );
+    shard->tree_->Traverse( action );
+  }
+}
+
+void CShardedAdaptiveRadixTree::TraverseIndexes( CIndexActionBase& action ) const
+{
+  for ( auto& shard : shards_ )
+  {
+    std::lock_guard<std::mutex> lock( shard->mutex_ );
+    shard->tree_->TraverseIndexes( action );
+  }
+}
+
+std::unique_ptr<CAdaptiveRadixTree> CShardedAdaptiveRadixTree::Release()
+{
+  if ( shards_.empty() )
+  {
+    return nullptr;
+  }
+
+  std::unique_ptr<CAdaptiveRadixTree> result = std::move( shards_[0]->tree_ );
+  std::vector<CAdaptiveRadixTree*> others;
+  for ( size_t i = 1; i < shards_.size(); ++i )
+  {
+    others.push_back( shards_[i]->tree_.get() );
+  }
+  result->JoinMany( others );
+  shards_.clear();
+  return result;
+}
+
+uint32_t CShardedAdaptiveRadixTree::GetNullStringCount() const
+{
+  std::lock_guard<std::mutex> lock( shards_[0]->mutex_ );
+  return shards_[0]->tree_->GetNullStringCount();
+}
+
+size_t CShardedAdaptiveRadixTree::GetMaxStringLength() const
+{
+  size_t result = 0;
+  for ( auto& shard : shards_ )
+  {
+    std::lock_guard<std::mutex> lock( shard->mutex_ );
+    result = std::max( result, shard->tree_->GetMaxStringLength() );
+  }
+  return result;
+}
+
+size_t CShardedAdaptiveRadixTree::GetUniqueStringCount() const
+{
+  // shards have disjoint key ranges, so no key is counted twice.
+  size_t result = 0;
+  for ( auto& shard : shards_ )
+  {
+    std::lock_guard<std::mutex> lock( shard->mutex_ );
+    result += shard->tree_->GetUniqueStringCount();
+  }
+  return result;
+}
+
+size_t CShardedAdaptiveRadixTree::GetTotalStringLength() const
+{
+  size_t result = 0;
+  for ( auto& shard : shards_ )
+  {
+    std::lock_guard<std::mutex> lock( shard->mutex_ );
+    result += shard->tree_->GetTotalStringLength();
+  }
+  return result;
+}
@@ -0,0 +1,327 @@
+#include "succinct_radix_tree.hpp"
+
+#include <algorithm>
+
+void CRankSelectBitVector::Build()
+{
+  rank_samples_.clear();
+  select0_samples_.clear();
+
+  size_t ones = 0;
+  size_t zeros = 0;
+  for ( size_t i = 0; i < words_.size(); ++i )
+  {
+    if ( i % WORDS_PER_RANK_SAMPLE == 0 )
+    {
+      rank_samples_.push_back( static_cast<uint32_t>( ones ) );
+    }
+
+    const size_t word_ones = detail::Helper::popcount64( words_[i] );
+    const size_t word_zeros = std::min<size_t>( 64, size_ - i * 64 ) - word_ones;
+    while ( select0_samples_.size() * ZEROS_PER_SELECT_SAMPLE < zeros + word_zeros )
+    {
+      select0_samples_.push_back( static_cast<uint32_t>( i ) );
+    }
+    ones += word_ones;
+    zeros += word_zeros;
+  }
+  // Rank1( size() ) may look at the sample after the last word.
+  rank_samples_.push_back( static_cast<uint32_t>( ones ) );
+
+  words_.shrink_to_fit();
+  rank_samples_.shrink_to_fit();
+  select0_samples_.shrink_to_fit();
+}
+
+size_t CRankSelectBitVector::Select0( size_t n ) const
+{
+  size_t word = select0_samples_[n / ZEROS_PER_SELECT_SAMPLE];
+  size_t zeros = word * 64 - Rank1( word * 64 );
+  for ( ;; ++word )
+  {
+    uint64_t inverted = ~words_[word];
+    const size_t count = detail::Helper::popcount64( inverted );
+    if ( zeros + count > n )
+    {
+      for ( n -= zeros; n; --n )
+      {
+        inverted &= inverted - 1;
+      }
+      return word * 64 + detail::Helper::ctz64( inverted );
+    }
+    zeros += count;
+  }
+}
+
+CSuccinctRadixTree::CSuccinctRadixTree( const CAdaptiveRadixTree & tree )
+    : null_string_( tree.null_string_ ),
+      null_string_count_( tree.null_string_count_ ),
+      max_string_length_( tree.max_string_length_ ),
+      unique_string_count_( tree.GetUniqueStringCount() ),
+      total_string_length_( tree.total_string_length_ ),
+      indexes_( tree.indexes_ )
+{
+  std::vector<CArtNode *> level, next_level;
+  if ( tree.root_ )
+  {
+    level.push_back( tree.root_ );
+  }
+
+  // nodes are numbered level by level, so that children of a node follow children of its left siblings.
+  bool dense = true;
+  while ( !level.empty() )
+  {
+    next_level.clear();
+    for ( CArtNode * node : level )
+    {
+      detail::Helper::ForEachChild( node, [&]( uint8_t, CArtNode *& child ) { next_level.push_back( child ); } );
+    }
+
+    // a level stays dense while its label bitmaps are at least 1/16 full, i.e. at most twice the size of
+    // sparse labels, and all levels above it are dense.
+    dense = dense && next_level.size() * 16 >= level.size() * 256;
+    if ( dense )
+    {
+      ++dense_level_count_;
+    }
+
+    for ( CArtNode * node : level )
+    {
+      terminal_.push_back( node->end_of_string_ );
+      if ( node->end_of_string_ )
+      {
+        values_.push_back( node->value_ );
+      }
+
+      has_prefix_.push_back( node->prefix_length_ != 0 );
+      if ( node->prefix_length_ )
+      {
+        prefixes_.append( tree.suffix_table_->data() + node->prefix_position_, node->prefix_length_ );
+        prefix_ends_.push_back( static_cast<uint32_t>( prefixes_.size() ) );
+      }
+
+      if ( dense )
+      {
+        dense_ranks_.push_back( dense_label_count_ );
+        dense_labels_.resize( dense_labels_.size() + 4, 0 );
+        uint64_t * labels = &dense_labels_[dense_labels_.size() - 4];
+        detail::Helper::ForEachChild( node, [&]( uint8_t c, CArtNode *& ) {
+          labels[c / 64] |= uint64_t( 1 ) << ( c % 64 );
+          ++dense_label_count_;
+        } );
+        ++dense_node_count_;
+      }
+      else
+      {
+        detail::Helper::ForEachChild( node, [&]( uint8_t c, CArtNode *& ) {
+          sparse_labels_.push_back( c );
+          sparse_louds_.push_back( true );
+        } );
+        sparse_louds_.push_back( false );
+      }
+    }
+
+    level.swap( next_level );
+  }
+
+  sparse_louds_.Build();
+  terminal_.Build();
+  has_prefix_.Build();
+  dense_labels_.shrink_to_fit();
+  dense_ranks_.shrink_to_fit();
+  sparse_labels_.shrink_to_fit();
+  values_.shrink_to_fit();
+  prefix_ends_.shrink_to_fit();
+  prefixes_.shrink_to_fit();
+}
+
+uint32_t CSuccinctRadixTree::FindChild( uint32_t node, uint8_t c ) const
+{
+  if ( node < dense_node_count_ )
+  {
+    const uint64_t * labels = &dense_labels_[node * 4];
+    const uint64_t bit = uint64_t( 1 ) << ( c % 64 );
+    if ( !( labels[c / 64] & bit ) )
+    {
+      return 0;
+    }
+
+    uint32_t rank = dense_ranks_[node] + detail::Helper::popcount64( labels[c / 64] & ( bit - 1 ) );
+    for ( unsigned word = 0; word < c / 64; ++word )
+    {
+      rank += detail::Helper::popcount64( labels[word] );
+    }
+    return 1 + rank;
+  }
+
+  size_t begin, end;
+  SparseLabels( node, begin, end );
+  const void * label = memchr( sparse_labels_.data() + begin, c, end - begin );
+  if ( !label )
+  {
+    return 0;
+  }
+  return static_cast<uint32_t>( 1 + dense_label_count_ + ( static_cast<const uint8_t *>( label ) - sparse_labels_.data() ) );
+}
+
+bool CSuccinctRadixTree::Find( const char* key, size_t key_length, CIndexIterator & begin, CIndexIterator & end ) const
+{
+  if ( !GetNodeCount() )
+  {
+    return false;
+  }
+
+  uint32_t node = 0;
+  size_t depth = 0;
+  for ( ;; )
+  {
+    size_t prefix_begin, prefix_end;
+    Prefix( node, prefix_begin, prefix_end );
+    const size_t prefix_length = prefix_end - prefix_begin;
+    if ( depth + prefix_length > key_length ||
+         detail::Helper::Mismatch( key + depth, prefixes_.data() + prefix_begin, prefix_length ) != prefix_length )
+    {
+      return false;
+    }
+    depth += prefix_length;
+
+    if ( depth == key_length )
+    {
+      if ( !terminal_[node] )
+      {
+        return false;
+      }
+      begin = Rows( node );
+      end = CIndexIterator( *indexes_, CArtNode::LAST_INDEX_IDENTIFIER );
+      return true;
+    }
+
+    node = FindChild( node, static_cast<uint8_t>( key[depth++] ) );
+    if ( !node )
+    {
+      return false;
+    }
+  }
+}
+
+void CSuccinctRadixTree::Traverse( CActionBase & action ) const
+{
+  std::string key;
+  ForEachKey( [&]( const char* key_bytes, size_t key_length, CIndexIterator begin, CIndexIterator end ) {
+    key.assign( key_bytes, key_length );
+    action.HandleTuple( key, begin, end );
+  } );
+}
+
+void CSuccinctRadixTree::TraverseRange( const char* low, size_t low_length, const char* high, size_t high_length,
+                                        CActionBase & action ) const
+{
+  if ( GetNodeCount() )
+  {
+    std::string key;
+    RangeRecursive( 0, detail::CKeyRangeCursor( low, low_length, high, high_length ), key, action );
+  }
+}
+
+void CSuccinctRadixTree::RangeRecursive( uint32_t node, detail::CKeyRangeCursor cursor, std::string & key,
+                                         CActionBase & action ) const
+{
+  const size_t depth = key.size();
+  size_t prefix_begin, prefix_end;
+  Prefix( node, prefix_begin, prefix_end );
+  key.append( prefixes_.data() + prefix_begin, prefix_end - prefix_begin );
+
+  if ( cursor.Advance( key.data(), depth, key.size() ) )
+  {
+    if ( terminal_[node] && cursor.Contains( key.size() ) )
+    {
+      action.HandleTuple( key, Rows( node ), CIndexIterator( *indexes_, CArtNode::LAST_INDEX_IDENTIFIER ) );
+    }
+
+    const size_t level = key.size();
+    ForEachChild( node, [&]( uint8_t c, uint32_t child ) {
+      key.push_back( static_cast<char>( c ) );
+      detail::CKeyRangeCursor child_cursor = cursor;
+      if ( child_cursor.Advance( key.data(), level, level + 1 ) )
+      {
+        RangeRecursive( child, child_cursor, key, action );
+      }
+      key.resize( level );
+    } );
+  }
+
+  key.resize( depth );
+}
+
+size_t CSuccinctRadixTree::ScanPoint( const char* key, size_t key_length, CRowSelection & selection ) const
+{
+  selection.Begin();
+  CIndexIterator begin, end;
+  return Find( key, key_length, begin, end ) ? selection.Add( begin, end ) : 0;
+}
+
+size_t CSuccinctRadixTree::ScanRange( const char* low, size_t low_length, const char* high, size_t high_length,
+                                      CRowSelection & selection ) const
+{
+  selection.Begin();
+  detail::CSelectAction action( selection );
+  TraverseRange( low, low_length, high, high_length, action );
+  return action.GetCount();
+}
+
+size_t CSuccinctRadixTree::ScanPrefix( const char* prefix, size_t prefix_length, CRowSelection & selection ) const
+{
+  selection.Begin();
+  if ( !GetNodeCount() )
+  {
+    return 0;
+  }
+
+  uint32_t node = 0;
+  size_t depth = 0;
+  for ( ;; )
+  {
+    // prefix may end inside prefix of the node.
+    size_t prefix_begin, prefix_end;
+    Prefix( node, prefix_begin, prefix_end );
+    const size_t length = std::min( prefix_end - prefix_begin, prefix_length - depth );
+    if ( detail::Helper::Mismatch( prefix + depth, prefixes_.data() + prefix_begin, length ) != length )
+    {
+      return 0;
+    }
+    depth += prefix_end - prefix_begin;
+
+    if ( depth >= prefix_length )
+    {
+      return SelectRecursive( node, selection );
+    }
+
+    node = FindChild( node, static_cast<uint8_t>( prefix[depth++] ) );
+    if ( !node )
+    {
+      return 0;
+    }
+  }
+}
+
+size_t CSuccinctRadixTree::ScanNull( CRowSelection & selection ) const
+{
+  selection.Begin();
+  return selection.Add( GetNullStringBegin(), GetNullStringEnd() );
+}
+
+size_t CSuccinctRadixTree::SelectRecursive( uint32_t node, CRowSelection & selection ) const
+{
+  size_t count =
+      terminal_[node] ? selection.Add( Rows( node ), CIndexIterator( *indexes_, CArtNode::LAST_INDEX_IDENTIFIER ) ) : 0;
+  ForEachChild( node, [&]( uint8_t, uint32_t child ) { count += SelectRecursive( child, selection ); } );
+  return count;
+}
+
+size_t CSuccinctRadixTree::GetMemoryUsage() const
+{
+  return sizeof( *this ) + dense_labels_.capacity() * sizeof( uint64_t ) + dense_ranks_.capacity() * sizeof( uint32_t ) +
+         sparse_labels_.capacity() + sparse_louds_.GetMemoryUsage() + terminal_.GetMemoryUsage() +
+         values_.capacity() * sizeof( uint32_t ) + has_prefix_.GetMemoryUsage() +
+         prefix_ends_.capacity() * sizeof( uint32_t ) + prefixes_.capacity();
+}
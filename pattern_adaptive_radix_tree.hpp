@@ -0,0 +1,88 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "adaptive_radix_tree.hpp"
+
+/// ART with companion indexes for LIKE patterns which don't start with a literal, such as '%.example.com' or
+/// '%error%', which CAdaptiveRadixTree::MatchPattern can only answer by visiting every key.
+///
+/// Besides the tree of keys, it optionally keeps
+/// - a tree of reversed keys, with rows of their own index vector; a pattern ending with a literal is reversed
+///   and matched there, so its literal suffix descends the reversed tree like a prefix.
+/// - a tree of the distinct trigrams (3 byte substrings) of each distinct key, whose rows are postings naming
+///   the key in a store of distinct keys; a pattern containing a literal of at least 3 bytes is answered from the
+///   keys having all trigrams of its longest literal, which are verified against the pattern and looked up in
+///   the tree of keys, so the other keys are never visited.
+/// Companions are updated by AddEntry and Join.
+class CPatternAdaptiveRadixTree
+{
+public:
+  enum Companion
+  {
+    ReverseKeys = 1,
+    Trigrams = 2,
+  };
+
+  /// companions is a combination of Companion flags.
+  explicit CPatternAdaptiveRadixTree( uint32_t max_index_count, unsigned companions = ReverseKeys | Trigrams );
+
+  CPatternAdaptiveRadixTree( const CPatternAdaptiveRadixTree& other ) = delete;
+  CPatternAdaptiveRadixTree& operator=( const CPatternAdaptiveRadixTree& ) = delete;
+
+  void AddEntry( const char* key, size_t key_length, uint32_t value );
+
+  void AddNullString( uint32_t value );
+
+  /// Calls action.HandleTuple in key order for each key matching given LIKE pattern, as
+  /// CAdaptiveRadixTree::MatchPattern does, using the companion which fits the pattern best.
+  void MatchPattern( const char* pattern, size_t pattern_length, CActionBase & action, char any_string = '%',
+                     char any_char = '_' ) const;
+
+  /// Returns an empty tree with the same companions whose trees share index vectors with ours, to be joined.
+  std::unique_ptr<CPatternAdaptiveRadixTree> Split();
+
+  /// Joins other, which has to come from Split, into this tree; other is left empty.
+  void Join( CPatternAdaptiveRadixTree & other );
+
+  const CAdaptiveRadixTree& GetTree() const
+  {
+    return *tree_;
+  }
+
+  /// Tree of reversed keys, or nullptr if it isn't kept.
+  const CAdaptiveRadixTree* GetReverseTree() const
+  {
+    return reverse_tree_.get();
+  }
+
+  /// Tree of trigrams, or nullptr if it isn't kept.
+  const CAdaptiveRadixTree* GetTrigramTree() const
+  {
+    return trigram_tree_.get();
+  }
+
+private:
+  CPatternAdaptiveRadixTree( std::unique_ptr<CAdaptiveRadixTree> tree, std::unique_ptr<CAdaptiveRadixTree> reverse_tree,
+                             bool trigrams );
+
+  /// Stores a new distinct key and adds postings of its trigrams.
+  void AddKey( const char* key, size_t key_length );
+
+  void MatchReversed( const char* pattern, size_t pattern_length, CActionBase & action, char any_string,
+                      char any_char ) const;
+
+  /// Matches pattern on the keys having all trigrams of given literal of it.
+  void MatchCandidates( const char* pattern, size_t pattern_length, const char* literal, size_t literal_length,
+                        CActionBase & action, char any_string, char any_char ) const;
+
+  std::unique_ptr<CAdaptiveRadixTree> tree_;
+  std::unique_ptr<CAdaptiveRadixTree> reverse_tree_;
+  std::unique_ptr<CAdaptiveRadixTree> trigram_tree_;  //< rows are postings.
+  std::vector<uint32_t> posting_keys_;                //< key of each posting, an index of key_ends_.
+  std::string key_bytes_;                             //< distinct keys one after another.
+  std::vector<size_t> key_ends_;                      //< end of each key in key_bytes_.
+  std::string reversed_key_;                          //< buffer of AddEntry.
+};
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "adaptive_radix_tree.hpp"
+
+/// ART partitioned into shards by first byte of the key, for concurrent insertions.
+///
+/// Each shard is a CAdaptiveRadixTree covering a contiguous range of first bytes and guarded by its
+/// own mutex, so threads inserting keys of different ranges don't contend. All shards share one
+/// index vector (see CAdaptiveRadixTree::Split), hence row indexes are global and traversing shards
+/// in order of their ranges visits all keys in key order. Empty keys and NULL strings go to the first shard.
+class CShardedAdaptiveRadixTree
+{
+public:
+  /// Creates shard_count shards covering (nearly) equal ranges of first byte.
+  CShardedAdaptiveRadixTree( uint32_t max_index_count, unsigned shard_count );
+
+  /// Creates a shard per range, shard_starts[i] being the smallest first byte of (i+1)-th shard;
+  /// first shard starts at 0 and shard_starts has to be strictly increasing.
+  /// Use this when key distribution is skewed, e.g. keys starting with digits only.
+  CShardedAdaptiveRadixTree( uint32_t max_index_count, const std::vector<uint8_t>& shard_starts );
+
+  CShardedAdaptiveRadixTree( const CShardedAdaptiveRadixTree& other ) = delete;
+  CShardedAdaptiveRadixTree& operator=( const CShardedAdaptiveRadixTree& ) = delete;
+
+  /// Thread safe, locks only the shard of the key.
+  void AddEntry( const char* key, size_t key_length, uint32_t value );
+
+  /// Thread safe, locks the first shard.
+  void AddNullString( uint32_t value );
+
+  /// Looks up key in its shard, see CAdaptiveRadixTree::Find. Thread safe, but returned iterators
+  /// read the shared index vector without locking, so they are only stable once insertions are done.
+  bool Find( const char* key, size_t key_length, CIndexIterator& begin, CIndexIterator& end ) const;
+
+  /// Traverses shards one after another, in key order. Each shard is locked while it is traversed.
+  void Traverse( CActionBase& action ) const;
+
+  void TraverseIndexes( CIndexActionBase& action ) const;
+
+  /// Joins all shards into a single tree and returns it; this object is left without shards.
+  /// Must not be called concurrently with other methods.
+  std::unique_ptr<CAdaptiveRadixTree> Release();
+
+  size_t GetShardCount() const
+  {
+    return shards_.size();
+  }
+
+  /// Returns shard of given first byte.
+  size_t GetShardIndex( uint8_t first_byte ) const
+  {
+    return shard_of_[first_byte];
+  }
+
+  const CAdaptiveRadixTree& GetShard( size_t index ) const
+  {
+    return *shards_[index]->tree_;
+  }
+
+  /// Following getters lock shards one at a time, so they are exact only when there are no concurrent insertions.
+  uint32_t GetNullStringCount() const;
+  size_t GetMaxStringLength() const;
+  size_t GetUniqueStringCount() const;
+  size_t GetTotalStringLength() const;
+
+  CIndexIterator GetNullStringBegin() const
+  {
+    return GetShard( 0 ).GetNullStringBegin();
+  }
+
+  CIndexIterator GetNullStringEnd() const
+  {
+    return GetShard( 0 ).GetNullStringEnd();
+  }
+
+private:
+  struct CShard
+  {
+    mutable std::mutex mutex_;
+    std::unique_ptr<CAdaptiveRadixTree> tree_;
+  };
+
+  void CreateShards( uint32_t max_index_count, const std::vector<uint8_t>& shard_starts );
+
+  size_t ShardOf( const char* key, size_t key_length ) const
+  {
+    return key_length ? shard_of_[static_cast<uint8_t>( key[0] )] : 0;
+  }
+
+  /// Shard index for each first byte.
+  uint16_t shard_of_[256];
+  std::vector<std::unique_ptr<CShard>> shards_;
+};
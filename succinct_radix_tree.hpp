@@ -0,0 +1,267 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "adaptive_radix_tree.hpp"
+
+/// Bit vector supporting rank of ones and select of zeros in (nearly) constant time.
+/// Rank is sampled every 512 bits and select every 256 zeros, which adds about 7% to the bits.
+class CRankSelectBitVector
+{
+public:
+  void push_back( bool bit )
+  {
+    if ( size_ % 64 == 0 )
+    {
+      words_.push_back( 0 );
+    }
+    words_.back() |= static_cast<uint64_t>( bit ) << ( size_ % 64 );
+    ++size_;
+  }
+
+  bool operator[]( size_t position ) const
+  {
+    return ( words_[position / 64] >> ( position % 64 ) ) & 1;
+  }
+
+  size_t size() const
+  {
+    return size_;
+  }
+
+  /// Builds rank and select samples, must be called after the last push_back.
+  void Build();
+
+  /// Returns number of ones in [0, position).
+  size_t Rank1( size_t position ) const
+  {
+    const size_t word = position / 64;
+    size_t rank = rank_samples_[word / WORDS_PER_RANK_SAMPLE];
+    for ( size_t i = word / WORDS_PER_RANK_SAMPLE * WORDS_PER_RANK_SAMPLE; i < word; ++i )
+    {
+      rank += detail::Helper::popcount64( words_[i] );
+    }
+    if ( position % 64 )
+    {
+      rank += detail::Helper::popcount64( words_[word] & ( ~uint64_t( 0 ) >> ( 64 - position % 64 ) ) );
+    }
+    return rank;
+  }
+
+  /// Returns position of the n-th zero, counting from 0.
+  size_t Select0( size_t n ) const;
+
+  size_t GetMemoryUsage() const
+  {
+    return words_.capacity() * sizeof( uint64_t ) + rank_samples_.capacity() * sizeof( uint32_t ) +
+           select0_samples_.capacity() * sizeof( uint32_t );
+  }
+
+private:
+  static const size_t WORDS_PER_RANK_SAMPLE = 8;
+  static const size_t ZEROS_PER_SELECT_SAMPLE = 256;
+
+  std::vector<uint64_t> words_;
+  size_t size_ = 0;
+  std::vector<uint32_t> rank_samples_;     //< ones before each group of WORDS_PER_RANK_SAMPLE words.
+  std::vector<uint32_t> select0_samples_;  //< word holding each ZEROS_PER_SELECT_SAMPLE-th zero.
+};
+
+/// Read-only trie built from a CAdaptiveRadixTree by CAdaptiveRadixTree::FreezeSuccinct, for partitions which
+/// don't change anymore. Each ART node becomes a trie node and nodes are numbered in breadth first order, so
+/// children of a node have consecutive numbers and child of i-th label of the trie is node i + 1; nodes
+/// need no pointers then. As in SuRF/FST, upper levels with large fanout are encoded dense, as a 256 bit
+/// label bitmap per node, and lower levels sparse (LOUDS), as sorted label bytes with a bit vector holding
+/// the degree of each node in unary. Node prefixes are kept in one string indexed by a rank over nodes
+/// having a prefix and chain heads of the shared index vector by a rank over terminal nodes.
+///
+/// Lookups, range scans and traversals take the same arguments as those of CAdaptiveRadixTree.
+/// CActionBase::HandleNode is not called since there are no CArtNodes.
+class CSuccinctRadixTree
+{
+public:
+  explicit CSuccinctRadixTree( const CAdaptiveRadixTree & tree );
+
+  CSuccinctRadixTree( const CSuccinctRadixTree & other ) = delete;
+  CSuccinctRadixTree& operator=( const CSuccinctRadixTree& ) = delete;
+
+  /// Looks up key and sets [begin, end) to its rows. Returns false if key is not stored.
+  bool Find( const char* key, size_t key_length, CIndexIterator & begin, CIndexIterator & end ) const;
+
+  /// Calls handler( const char* key, size_t key_length, CIndexIterator begin, CIndexIterator end ) for
+  /// each key in key order, see CAdaptiveRadixTree::ForEachKey.
+  template <typename Handler>
+  void ForEachKey( Handler && handler ) const
+  {
+    if ( GetNodeCount() )
+    {
+      std::unique_ptr<char[]> key( new char[max_string_length_ + 1] );
+      ForEachKeyRecursive( 0, key.get(), 0, handler );
+    }
+  }
+
+  void Traverse( CActionBase & action ) const;
+
+  /// Calls action.HandleTuple in key order for each key in [low, high].
+  void TraverseRange( const char* low, size_t low_length, const char* high, size_t high_length,
+                      CActionBase & action ) const;
+
+  /// Scans as CAdaptiveRadixTree::ScanPoint and its siblings do.
+  size_t ScanPoint( const char* key, size_t key_length, CRowSelection & selection ) const;
+  size_t ScanRange( const char* low, size_t low_length, const char* high, size_t high_length,
+                    CRowSelection & selection ) const;
+  size_t ScanPrefix( const char* prefix, size_t prefix_length, CRowSelection & selection ) const;
+  size_t ScanNull( CRowSelection & selection ) const;
+
+  CIndexIterator GetNullStringBegin() const
+  {
+    return CIndexIterator( *indexes_, null_string_ );
+  }
+
+  CIndexIterator GetNullStringEnd() const
+  {
+    return CIndexIterator( *indexes_, CArtNode::LAST_INDEX_IDENTIFIER );
+  }
+
+  uint32_t GetNullStringCount() const
+  {
+    return null_string_count_;
+  }
+
+  size_t GetMaxStringLength() const
+  {
+    return max_string_length_;
+  }
+
+  size_t GetUniqueStringCount() const
+  {
+    return unique_string_count_;
+  }
+
+  size_t GetTotalStringLength() const
+  {
+    return total_string_length_;
+  }
+
+  size_t GetNodeCount() const
+  {
+    return terminal_.size();
+  }
+
+  /// Number of levels encoded dense.
+  size_t GetDenseLevelCount() const
+  {
+    return dense_level_count_;
+  }
+
+  /// Returns bytes used by the trie, not counting the shared index vector.
+  size_t GetMemoryUsage() const;
+
+private:
+  /// Calls function( label byte, child node ) for each child of node in label order.
+  template <typename Function>
+  void ForEachChild( uint32_t node, Function function ) const
+  {
+    if ( node < dense_node_count_ )
+    {
+      uint32_t child = 1 + dense_ranks_[node];
+      for ( unsigned word = 0; word < 4; ++word )
+      {
+        for ( uint64_t bits = dense_labels_[node * 4 + word]; bits; bits &= bits - 1 )
+        {
+          function( static_cast<uint8_t>( word * 64 + detail::Helper::ctz64( bits ) ), child++ );
+        }
+      }
+    }
+    else
+    {
+      size_t begin, end;
+      SparseLabels( node, begin, end );
+      for ( size_t i = begin; i < end; ++i )
+      {
+        function( sparse_labels_[i], static_cast<uint32_t>( 1 + dense_label_count_ + i ) );
+      }
+    }
+  }
+
+  /// Returns child of node for given label, or 0 (root, which is nobody's child) if there is none.
+  uint32_t FindChild( uint32_t node, uint8_t c ) const;
+
+  /// Sets [begin, end) to positions of labels of a sparse node in sparse_labels_.
+  void SparseLabels( uint32_t node, size_t & begin, size_t & end ) const
+  {
+    const size_t sparse_node = node - dense_node_count_;
+    begin = ( sparse_node ? sparse_louds_.Select0( sparse_node - 1 ) + 1 : 0 ) - sparse_node;
+    end = sparse_louds_.Select0( sparse_node ) - sparse_node;
+  }
+
+  /// Sets prefix of node to [begin, end) of prefixes_.
+  void Prefix( uint32_t node, size_t & begin, size_t & end ) const
+  {
+    begin = end = 0;
+    if ( has_prefix_[node] )
+    {
+      const size_t rank = has_prefix_.Rank1( node );
+      begin = rank ? prefix_ends_[rank - 1] : 0;
+      end = prefix_ends_[rank];
+    }
+  }
+
+  CIndexIterator Rows( uint32_t node ) const
+  {
+    return CIndexIterator( *indexes_, values_[terminal_.Rank1( node )] );
+  }
+
+  template <typename Handler>
+  void ForEachKeyRecursive( uint32_t node, char* key, size_t key_length, Handler & handler ) const;
+
+  void RangeRecursive( uint32_t node, detail::CKeyRangeCursor cursor, std::string & key,
+                       CActionBase & action ) const;
+
+  /// Adds rows of all keys in subtree of node to selection, returns their number.
+  size_t SelectRecursive( uint32_t node, CRowSelection & selection ) const;
+
+  size_t dense_level_count_ = 0;
+  uint32_t dense_node_count_ = 0;
+  uint32_t dense_label_count_ = 0;
+  std::vector<uint64_t> dense_labels_;  //< 256 bit label bitmap of each dense node.
+  std::vector<uint32_t> dense_ranks_;   //< labels of dense nodes before each dense node.
+
+  std::vector<uint8_t> sparse_labels_;
+  CRankSelectBitVector sparse_louds_;  //< degree of each sparse node in unary, i.e. a one per label and a zero.
+
+  CRankSelectBitVector terminal_;      //< nodes with end of string.
+  std::vector<uint32_t> values_;       //< chain head of each terminal node.
+  CRankSelectBitVector has_prefix_;    //< nodes with a prefix.
+  std::vector<uint32_t> prefix_ends_;  //< end of prefix of each node having one in prefixes_.
+  std::string prefixes_;
+
+  uint32_t null_string_ = CArtNode::LAST_INDEX_IDENTIFIER;
+  uint32_t null_string_count_ = 0;
+  size_t max_string_length_ = 0;
+  size_t unique_string_count_ = 0;
+  size_t total_string_length_ = 0;
+  std::shared_ptr<std::vector<uint32_t>> indexes_;
+};
+
+template <typename Handler>
+void CSuccinctRadixTree::ForEachKeyRecursive( uint32_t node, char* key, size_t key_length, Handler & handler ) const
+{
+  size_t prefix_begin, prefix_end;
+  Prefix( node, prefix_begin, prefix_end );
+  memcpy( key + key_length, prefixes_.data() + prefix_begin, prefix_end - prefix_begin );
+  key_length += prefix_end - prefix_begin;
+
+  if ( terminal_[node] )
+  {
+    handler( const_cast<const char*>( key ), key_length, Rows( node ),
+             CIndexIterator( *indexes_, CArtNode::LAST_INDEX_IDENTIFIER ) );
+  }
+
+  ForEachChild( node, [&]( uint8_t c, uint32_t child ) {
+    key[key_length] = static_cast<char>( c );
+    ForEachKeyRecursive( child, key, key_length + 1, handler );
+  } );
+}
@@ -6,12 +6,25 @@
 #include <utility>
 
 #include <algorithm>
+#include <functional>
 #include <iostream>
+#include <map>
+#include <set>
+#include <thread>
+#include <tuple>
 #include <iterator>
 #include <random>
 #include <vector>
 
+#include <unistd.h>
+
 #include "adaptive_radix_tree.hpp"
+#include "adaptive_radix_tree_external.hpp"
+#include "adaptive_radix_tree_loader.hpp"
+#include "buffered_adaptive_radix_tree.hpp"
+#include "pattern_adaptive_radix_tree.hpp"
+#include "sharded_adaptive_radix_tree.hpp"
+#include "succinct_radix_tree.hpp"
 #include "utils.hpp"
 
 namespace
@@ -23,6 +36,97 @@ struct TestParam
   size_t min_string_length;
   size_t max_string_length;
 };
+
+/// Collects keys and their rows in traversal order.
+class CCollector : public CActionBase
+{
+public:
+  virtual void HandleNode( CArtNode const*, std::string const&, uint32_t )
+  {
+  }
+
+  virtual void HandleTuple( std::string const& str, CIndexIterator begin, CIndexIterator end )
+  {
+    keys_.push_back( str );
+    auto& rows = values_[str];
+    rows.insert( rows.end(), begin, end );
+    std::sort( rows.begin(), rows.end() );
+  }
+
+  std::vector<std::string> keys_;
+  std::map<std::string, std::vector<uint32_t>> values_;
+};
+
+std::map<std::string, std::vector<uint32_t>> Collect( const CAdaptiveRadixTree& tree )
+{
+  CCollector collector;
+  tree.Traverse( collector );
+  return collector.values_;
+}
+
+/// Builds a tree from given keys, i-th key gets row i.
+std::unique_ptr<CAdaptiveRadixTree> Build( const std::vector<std::string>& keys )
+{
+  auto tree = std::make_unique<CAdaptiveRadixTree>( keys.size() );
+  for ( uint32_t i = 0; i < keys.size(); ++i )
+  {
+    tree->AddEntry( keys[i].c_str(), keys[i].size(), i );
+  }
+  return tree;
+}
+
+/// Rows of given keys, reference implementation for searches.
+std::map<std::string, std::vector<uint32_t>> Filter( const std::vector<std::string>& keys,
+                                                     std::function<bool( const std::string& )> predicate )
+{
+  std::map<std::string, std::vector<uint32_t>> result;
+  for ( uint32_t i = 0; i < keys.size(); ++i )
+  {
+    if ( predicate( keys[i] ) )
+    {
+      result[keys[i]].push_back( i );
+    }
+  }
+  return result;
+}
+
+bool Like( const char* key, const char* pattern )
+{
+  if ( !*pattern )
+  {
+    return !*key;
+  }
+  if ( *pattern == '%' )
+  {
+    return Like( key, pattern + 1 ) || ( *key && Like( key + 1, pattern ) );
+  }
+  return *key && ( *pattern == '_' || *pattern == *key ) && Like( key + 1, pattern + 1 );
+}
+
+size_t EditDistance( const std::string& left, const std::string& right )
+{
+  std::vector<size_t> row( right.size() + 1 );
+  for ( size_t j = 0; j <= right.size(); ++j )
+  {
+    row[j] = j;
+  }
+  for ( size_t i = 1; i <= left.size(); ++i )
+  {
+    size_t diagonal = row[0];
+    row[0] = i;
+    for ( size_t j = 1; j <= right.size(); ++j )
+    {
+      size_t above = row[j];
+      row[j] = std::min( std::min( row[j], row[j - 1] ) + 1, diagonal + ( left[i - 1] != right[j - 1] ) );
+      diagonal = above;
+    }
+  }
+  return row[right.size()];
+}
+
+const std::vector<std::string> WORDS = {"alize",  "alt",   "ali",     "alize", "b",      "bob",   "alizee",
+                                        "c",      "",      "alibaba", "zeze",  "alizex", "error", "an error",
+                                        "errors", "terror", "ali",    "tool",  "tools",  "to",    "a_b%c"};
 }
 
 class ConstructARTWithRandomStrings : public testing::TestWithParam<TestParam>
@@ -94,6 +198,1101 @@ TEST_P( ConstructARTWithRandomStrings, TraverseCheck )
   ASSERT_EQ( values_total_char_count, traverser.total_char_count );
 }
 
+TEST( AdaptiveRadixTree, SnapshotIsNotAffectedByLaterInsertions )
+{
+  std::vector<std::string> keys = {"alize", "alt", "ali", "alize", "b", "bob", "alizee", "c"};
+  CAdaptiveRadixTree tree( 3 * keys.size() );
+
+  std::map<std::string, std::vector<uint32_t>> expected;
+  for ( uint32_t i = 0; i < keys.size() / 2; ++i )
+  {
+    tree.AddEntry( keys[i].c_str(), keys[i].size(), i );
+    expected[keys[i]].push_back( i );
+  }
+
+  auto snapshot = tree.Snapshot();
+  for ( uint32_t i = keys.size() / 2; i < 2 * keys.size(); ++i )
+  {
+    auto& key = keys[i % keys.size()];
+    tree.AddEntry( key.c_str(), key.size(), i );
+  }
+
+  auto other = tree.Split();
+  for ( uint32_t i = 2 * keys.size(); i < 3 * keys.size(); ++i )
+  {
+    auto key = keys[i % keys.size()] + "x";
+    other->AddEntry( key.c_str(), key.size(), i );
+  }
+  tree.Join( *other );
+
+  ASSERT_EQ( expected, Collect( *snapshot ) );
+  ASSERT_EQ( 3u, snapshot->GetUniqueStringCount() );
+  ASSERT_EQ( 14u, tree.GetUniqueStringCount() );
+  ASSERT_EQ( 14u, Collect( tree ).size() );
+
+  tree.Reset();
+  ASSERT_EQ( expected, Collect( *snapshot ) );
+}
+
+#ifdef ART_ENABLE_STATS
+TEST( AdaptiveRadixTree, StatsCountNodeGrowthAndPrefixSplits )
+{
+  CAdaptiveRadixTree tree( 300 );
+  std::string key = "prefix_";
+  for ( uint32_t i = 0; i < 256; ++i )
+  {
+    key.back() = static_cast<char>( i );
+    tree.AddEntry( key.c_str(), key.size(), i );
+  }
+  tree.AddEntry( "pre", 3, 256 );
+  tree.AddNullString( 257 );
+
+  auto stats = tree.GetStats();
+  ASSERT_EQ( 257u, stats.insert_count_ );
+  ASSERT_EQ( 1u, stats.null_insert_count_ );
+  ASSERT_EQ( 1u, stats.grow_count_[CArtNode::Type::Fanout4] );
+  ASSERT_EQ( 1u, stats.grow_count_[CArtNode::Type::Fanout16] );
+  ASSERT_EQ( 1u, stats.grow_count_[CArtNode::Type::Fanout48] );
+  ASSERT_EQ( 2u, stats.prefix_split_count_ );
+}
+#endif
+
+TEST( AdaptiveRadixTree, MatchPattern )
+{
+  auto tree = Build( WORDS );
+  for ( std::string pattern : {"%", "", "a%", "%ze", "_l%e", "alize", "a_i%", "%l%z%", "%error%", "to%", "%o_",
+                               "a\\_%", "___", "%e%e%e%", "b_b", "x%"} )
+  {
+    CCollector collector;
+    tree->MatchPattern( pattern.c_str(), pattern.size(), collector );
+    ASSERT_EQ( Filter( WORDS, [&]( const std::string& key ) { return Like( key.c_str(), pattern.c_str() ); } ),
+               collector.values_ )
+        << pattern;
+    ASSERT_TRUE( std::is_sorted( collector.keys_.begin(), collector.keys_.end() ) );
+  }
+
+  CCollector collector;
+  tree->MatchPattern( "*iz?", 4, collector, '*', '?' );
+  ASSERT_EQ( Filter( WORDS, [&]( const std::string& key ) { return Like( key.c_str(), "%iz_" ); } ),
+             collector.values_ );
+}
+
+TEST( AdaptiveRadixTree, PatternCompanions )
+{
+  std::vector<std::string> keys;
+  std::mt19937 generator( 47 );
+  const std::vector<std::string> hosts = {".example.com", ".example.org", ".test.com", ".com"};
+  for ( int i = 0; i < 4000; ++i )
+  {
+    std::string key = WORDS[generator() % WORDS.size()];
+    key += i % 3 ? hosts[generator() % hosts.size()] : " error " + std::to_string( generator() % 50 );
+    keys.push_back( key );
+  }
+  auto tree = Build( keys );
+
+  for ( unsigned companions : {0u, 1u, 2u, 3u} )
+  {
+    CPatternAdaptiveRadixTree pattern_tree( keys.size(), companions );
+    auto other = pattern_tree.Split();
+    for ( uint32_t i = 0; i < keys.size(); ++i )
+    {
+      ( i % 2 ? pattern_tree : *other ).AddEntry( keys[i].data(), keys[i].size(), i );
+    }
+    pattern_tree.Join( *other );
+    ASSERT_EQ( Collect( *tree ), Collect( pattern_tree.GetTree() ) );
+
+    for ( const char* pattern : {"%.example.com", "%error%", "%error 1_", "al%", "%e_a%", "%or%", "%",
+                                 "%xample.c%m", "%not there%", "_%.com"} )
+    {
+      CCollector expected, actual;
+      tree->MatchPattern( pattern, strlen( pattern ), expected );
+      pattern_tree.MatchPattern( pattern, strlen( pattern ), actual );
+      ASSERT_EQ( expected.keys_, actual.keys_ ) << pattern << " " << companions;
+      ASSERT_EQ( expected.values_, actual.values_ ) << pattern << " " << companions;
+    }
+  }
+}
+
+#ifdef ART_ENABLE_STATS
+TEST( AdaptiveRadixTree, TrigramsMatchOnlyCandidates )
+{
+  CPatternAdaptiveRadixTree pattern_tree( 1000, CPatternAdaptiveRadixTree::Trigrams );
+  size_t match_count = 0;
+  for ( uint32_t i = 0; i < 1000; ++i )
+  {
+    const std::string key = WORDS[i % WORDS.size()] + ( i % 100 ? " ok " : " #error# " ) + std::to_string( i );
+    pattern_tree.AddEntry( key.data(), key.size(), i );
+    match_count += key.find( "#error#" ) != std::string::npos;
+  }
+
+  // matching keys are looked up in the tree of keys, which is never traversed.
+  const CArtStats before = pattern_tree.GetTree().GetStats();
+  CCollector collector;
+  pattern_tree.MatchPattern( "%#error#%", 9, collector );
+  const CArtStats after = pattern_tree.GetTree().GetStats();
+  ASSERT_LT( match_count, pattern_tree.GetTree().GetUniqueStringCount() / 10 );
+  ASSERT_EQ( match_count, collector.keys_.size() );
+  ASSERT_EQ( before.traverse_count_, after.traverse_count_ );
+  ASSERT_EQ( before.traversed_node_count_, after.traversed_node_count_ );
+  ASSERT_EQ( before.lookup_count_ + match_count, after.lookup_count_ );
+}
+#endif
+
+TEST( AdaptiveRadixTree, FuzzySearch )
+{
+  auto tree = Build( WORDS );
+  for ( std::string query : {"alize", "", "eror", "tols", "bb", "alibabaa"} )
+  {
+    for ( uint32_t distance = 0; distance < 4; ++distance )
+    {
+      CCollector collector;
+      tree->FuzzySearch( query.c_str(), query.size(), distance, collector );
+      ASSERT_EQ( Filter( WORDS, [&]( const std::string& key ) { return EditDistance( key, query ) <= distance; } ),
+                 collector.values_ )
+          << query << " " << distance;
+    }
+  }
+}
+
+TEST( AdaptiveRadixTree, LongestPrefixMatch )
+{
+  auto tree = Build( WORDS );
+  for ( std::string query : {"alizeex", "alize", "aliz", "al", "tools/x", "errorsz", "x", "", "bo", "terror"} )
+  {
+    auto prefixes =
+        Filter( WORDS, [&]( const std::string& key ) { return query.compare( 0, key.size(), key ) == 0; } );
+
+    CCollector collector;
+    tree->PrefixMatches( query.c_str(), query.size(), collector );
+    ASSERT_EQ( prefixes, collector.values_ ) << query;
+
+    CIndexIterator begin, end;
+    int64_t length = tree->LongestPrefixMatch( query.c_str(), query.size(), begin, end );
+    if ( prefixes.empty() )
+    {
+      ASSERT_EQ( -1, length );
+      ASSERT_TRUE( begin == end );
+    }
+    else
+    {
+      auto& longest = *prefixes.rbegin();
+      ASSERT_EQ( longest.first.size(), length );
+      std::vector<uint32_t> rows( begin, end );
+      std::sort( rows.begin(), rows.end() );
+      ASSERT_EQ( longest.second, rows );
+    }
+  }
+}
+
+TEST( AdaptiveRadixTree, SetOperations )
+{
+  std::vector<std::string> other_words = {"alize", "al", "alibaba", "errors", "erro", "b", "bobby", "zeze", "",
+                                          "tool", "alize", "zz", "terrorx", "a_b%c"};
+  auto tree = Build( WORDS );
+  auto other = Build( other_words );
+  std::set<std::string> other_keys( other_words.begin(), other_words.end() );
+
+  CCollector intersection;
+  tree->Intersect( *other, intersection );
+  ASSERT_EQ( Filter( WORDS, [&]( const std::string& key ) { return other_keys.count( key ) != 0; } ),
+             intersection.values_ );
+  ASSERT_TRUE( std::is_sorted( intersection.keys_.begin(), intersection.keys_.end() ) );
+
+  CCollector difference;
+  tree->Difference( *other, difference );
+  ASSERT_EQ( Filter( WORDS, [&]( const std::string& key ) { return other_keys.count( key ) == 0; } ),
+             difference.values_ );
+  ASSERT_TRUE( std::is_sorted( difference.keys_.begin(), difference.keys_.end() ) );
+
+  class CPairs : public CJoinActionBase
+  {
+  public:
+    virtual void HandleTuple( const std::string& key, CIndexIterator left_begin, CIndexIterator left_end,
+                              CIndexIterator right_begin, CIndexIterator right_end )
+    {
+      for ( ; left_begin != left_end; ++left_begin )
+      {
+        for ( auto it = right_begin; it != right_end; ++it )
+        {
+          pairs_.insert( std::make_tuple( key, *left_begin, *it ) );
+        }
+      }
+    }
+
+    std::set<std::tuple<std::string, uint32_t, uint32_t>> pairs_;
+  };
+
+  std::set<std::tuple<std::string, uint32_t, uint32_t>> expected;
+  for ( uint32_t i = 0; i < WORDS.size(); ++i )
+  {
+    for ( uint32_t j = 0; j < other_words.size(); ++j )
+    {
+      if ( WORDS[i] == other_words[j] )
+      {
+        expected.insert( std::make_tuple( WORDS[i], i, j ) );
+      }
+    }
+  }
+
+  CPairs pairs;
+  tree->MergeJoin( *other, pairs );
+  ASSERT_EQ( expected, pairs.pairs_ );
+}
+
+TEST( AdaptiveRadixTree, AddEntriesMatchesAddEntry )
+{
+  std::vector<std::string> keys;
+  for ( int i = 0; i < 2000; ++i )
+  {
+    keys.push_back( "http://example.com/" + std::to_string( i % 7 ) + "/item/" + std::to_string( i / 3 ) );
+  }
+  keys.insert( keys.end(), WORDS.begin(), WORDS.end() );
+  std::sort( keys.begin() + 1000, keys.end() );
+
+  std::vector<const char*> key_pointers;
+  std::vector<size_t> key_lengths;
+  std::vector<uint32_t> values;
+  for ( uint32_t i = 0; i < keys.size(); ++i )
+  {
+    key_pointers.push_back( keys[i].c_str() );
+    key_lengths.push_back( keys[i].size() );
+    values.push_back( i );
+  }
+
+  auto expected = Build( keys );
+  CAdaptiveRadixTree tree( keys.size() );
+  tree.AddEntries( key_pointers.data(), key_lengths.data(), values.data(), 500 );
+  tree.AddEntries( key_pointers.data() + 500, key_lengths.data() + 500, values.data() + 500, keys.size() - 500 );
+
+  ASSERT_EQ( Collect( *expected ), Collect( tree ) );
+  ASSERT_EQ( expected->GetUniqueStringCount(), tree.GetUniqueStringCount() );
+  ASSERT_EQ( expected->GetTotalStringLength(), tree.GetTotalStringLength() );
+  ASSERT_EQ( expected->GetMaxStringLength(), tree.GetMaxStringLength() );
+}
+
+TEST( AdaptiveRadixTree, LoadFromFile )
+{
+  std::vector<std::string> records;
+  for ( int i = 0; i < 3000; ++i )
+  {
+    records.push_back( i % 11 ? WORDS[i % WORDS.size()] + std::to_string( i % 97 ) : "" );
+  }
+
+  char path[] = "/tmp/artgtestXXXXXX";
+  int fd = mkstemp( path );
+  ASSERT_GE( fd, 0 );
+  std::string content;
+  for ( auto& record : records )
+  {
+    content += record + ";";
+  }
+  content.pop_back();  // last record is not terminated.
+  ASSERT_EQ( static_cast<ssize_t>( content.size() ), write( fd, content.data(), content.size() ) );
+  close( fd );
+
+  std::map<std::string, std::vector<uint32_t>> expected;
+  std::vector<uint32_t> nulls;
+  for ( uint32_t i = 0; i < records.size(); ++i )
+  {
+    ( records[i].empty() ? nulls : expected[records[i]] ).push_back( i );
+  }
+
+  CArtFileLoader loader( path );
+  for ( unsigned threads : {1, 3} )
+  {
+    auto tree = loader.Build( ';', threads );
+    ASSERT_EQ( records.size(), tree->GetIndexVectorLength() );
+    ASSERT_EQ( expected, Collect( *tree ) );
+
+    std::vector<uint32_t> null_rows( tree->GetNullStringBegin(), tree->GetNullStringEnd() );
+    std::sort( null_rows.begin(), null_rows.end() );
+    ASSERT_EQ( nulls, null_rows );
+  }
+  unlink( path );
+
+  ASSERT_THROW( CArtFileLoader( "/nonexistent/artgtest" ), std::system_error );
+}
+
+TEST( AdaptiveRadixTree, JoinMany )
+{
+  const uint32_t row_count = 12000;
+  std::vector<std::string> records;
+  std::mt19937 generator( 45 );
+  for ( uint32_t i = 0; i < row_count; ++i )
+  {
+    std::string key = i % 17 ? WORDS[generator() % WORDS.size()] : "";
+    for ( size_t length = generator() % 4; length; --length )
+    {
+      key.push_back( static_cast<char>( 'a' + generator() % 3 ) );
+    }
+    records.push_back( key );
+  }
+
+  // rows are dealt to trees round robin, so the same keys are in many trees.
+  auto build = [&]( std::vector<std::unique_ptr<CAdaptiveRadixTree>>& trees, size_t count ) {
+    trees.emplace_back( new CAdaptiveRadixTree( row_count ) );
+    for ( size_t i = 1; i < count; ++i )
+    {
+      trees.push_back( trees[0]->Split() );
+    }
+    for ( uint32_t i = 0; i < row_count; ++i )
+    {
+      if ( i % 97 == 0 )
+      {
+        trees[i % count]->AddNullString( i );
+      }
+      else
+      {
+        trees[i % count]->AddEntry( records[i].data(), records[i].size(), i );
+      }
+    }
+  };
+
+  std::vector<std::unique_ptr<CAdaptiveRadixTree>> joined, joined_many;
+  build( joined, 7 );
+  build( joined_many, 7 );
+  auto snapshot = joined_many[0]->Snapshot();
+  const auto snapshot_keys = Collect( *snapshot );
+
+  for ( size_t i = 1; i < joined.size(); ++i )
+  {
+    joined[0]->Join( *joined[i] );
+  }
+  std::vector<CAdaptiveRadixTree*> others;
+  for ( size_t i = 1; i < joined_many.size(); ++i )
+  {
+    others.push_back( joined_many[i].get() );
+  }
+  joined_many[0]->JoinMany( others );
+
+  ASSERT_EQ( Collect( *joined[0] ), Collect( *joined_many[0] ) );
+  ASSERT_EQ( joined[0]->GetUniqueStringCount(), joined_many[0]->GetUniqueStringCount() );
+  ASSERT_EQ( joined[0]->GetNullStringCount(), joined_many[0]->GetNullStringCount() );
+  ASSERT_EQ( joined[0]->GetTotalStringLength(), joined_many[0]->GetTotalStringLength() );
+  ASSERT_EQ( snapshot_keys, Collect( *snapshot ) );
+
+  for ( size_t i = 0; i < records.size(); i += 13 )
+  {
+    CIndexIterator begin, end, many_begin, many_end;
+    bool found = joined[0]->Find( records[i].data(), records[i].size(), begin, end );
+    ASSERT_EQ( found, joined_many[0]->Find( records[i].data(), records[i].size(), many_begin, many_end ) );
+  }
+}
+
+TEST( AdaptiveRadixTree, ExternalBuild )
+{
+  std::vector<std::string> records;
+  std::mt19937 generator( 44 );
+  for ( int i = 0; i < 20000; ++i )
+  {
+    records.push_back( i % 13 ? WORDS[generator() % WORDS.size()] + std::to_string( generator() % 500 ) : "" );
+  }
+
+  // rows are added out of order, as they would be when reading partitions of a column.
+  std::vector<uint32_t> order( records.size() );
+  for ( uint32_t i = 0; i < order.size(); ++i )
+  {
+    order[i] = i;
+  }
+  std::shuffle( order.begin(), order.end(), generator );
+
+  std::map<std::string, std::vector<uint32_t>> expected;
+  std::vector<uint32_t> nulls;
+  for ( uint32_t i = 0; i < records.size(); ++i )
+  {
+    ( records[i].empty() ? nulls : expected[records[i]] ).push_back( i );
+  }
+  auto check = [&]( const CAdaptiveRadixTree& tree ) {
+    ASSERT_EQ( records.size(), tree.GetIndexVectorLength() );
+    ASSERT_EQ( expected, Collect( tree ) );
+    std::vector<uint32_t> null_rows( tree.GetNullStringBegin(), tree.GetNullStringEnd() );
+    std::sort( null_rows.begin(), null_rows.end() );
+    ASSERT_EQ( nulls, null_rows );
+  };
+  auto add = [&]( CArtExternalBuilder& builder ) {
+    for ( uint32_t row : order )
+    {
+      if ( records[row].empty() )
+      {
+        builder.AddNullString( row );
+      }
+      else
+      {
+        builder.AddEntry( records[row].data(), records[row].size(), row );
+      }
+    }
+  };
+
+  CArtExternalBuilder builder( 64 * 1024 );
+  add( builder );
+  ASSERT_GT( builder.GetRunCount(), 3u );
+  check( *builder.Build() );
+  ASSERT_EQ( 0u, builder.GetRunCount() );
+
+  // a run every few keys, so runs are merged whenever there are too many of them.
+  CArtExternalBuilder small_builder( 4 * 1024 );
+  add( small_builder );
+  ASSERT_LE( small_builder.GetRunCount(), CArtExternalBuilder::MAX_RUN_COUNT );
+  check( *small_builder.Build() );
+
+  // everything fits, so nothing is spilled.
+  CArtExternalBuilder large_builder( 1 << 30 );
+  add( large_builder );
+  ASSERT_EQ( 0u, large_builder.GetRunCount() );
+  check( *large_builder.Build() );
+
+  char path[] = "/tmp/artgtestXXXXXX";
+  int fd = mkstemp( path );
+  ASSERT_GE( fd, 0 );
+  close( fd );
+  add( builder );
+  builder.Write( path );
+  check( *CArtExternalBuilder::Load( path ) );
+
+  // files of another format or version are rejected.
+  const uint32_t headers[][3] = {{0x12345678, 1, 0}, {0x52545241, 2, 0}};
+  for ( const auto& header : headers )
+  {
+    FILE* file = fopen( path, "wb" );
+    ASSERT_TRUE( file );
+    ASSERT_EQ( sizeof( header ), fwrite( header, 1, sizeof( header ), file ) );
+    fclose( file );
+    ASSERT_THROW( CArtExternalBuilder::Load( path ), std::runtime_error );
+  }
+  unlink( path );
+
+  ASSERT_THROW( CArtExternalBuilder::Load( "/nonexistent/artgtest" ), std::system_error );
+}
+
+TEST( AdaptiveRadixTree, ForEachKeyMatchesTraverse )
+{
+  std::vector<std::string> keys;
+  for ( int i = 0; i < 5000; ++i )
+  {
+    keys.push_back( WORDS[i % WORDS.size()] + std::string( i % 40, 'x' ) + std::to_string( i % 300 ) );
+  }
+  auto tree = Build( keys );
+  CCollector expected;
+  tree->Traverse( expected );
+
+  std::vector<std::string> visited;
+  std::map<std::string, std::vector<uint32_t>> values;
+  tree->ForEachKey( [&]( const char* key, size_t key_length, CIndexIterator begin, CIndexIterator end ) {
+    visited.emplace_back( key, key_length );
+    std::vector<uint32_t> rows( begin, end );
+    std::sort( rows.begin(), rows.end() );
+    values[visited.back()] = rows;
+  } );
+  ASSERT_EQ( expected.keys_, visited );
+  ASSERT_EQ( expected.values_, values );
+
+  struct CKeyCounter : CKeyActionBase
+  {
+    void HandleKey( const char*, size_t, CIndexIterator, CIndexIterator ) override
+    {
+      ++count_;
+    }
+    size_t count_ = 0;
+  } counter;
+  tree->TraverseKeys( counter );
+  ASSERT_EQ( tree->GetUniqueStringCount(), counter.count_ );
+}
+
+TEST( AdaptiveRadixTree, TraverseRange )
+{
+  auto tree = Build( WORDS );
+  for ( auto range : std::vector<std::pair<std::string, std::string>>{
+           {"", "\xff"}, {"al", "alizee"}, {"ali", "ali"}, {"alj", "b"}, {"b", "a"}, {"", ""}, {"to", "tools"},
+           {"an error", "errors"}, {"c", "zz"}} )
+  {
+    CCollector collector;
+    tree->TraverseRange( range.first.data(), range.first.size(), range.second.data(), range.second.size(),
+                         collector );
+    ASSERT_EQ( Filter( WORDS, [&]( const std::string& key ) { return range.first <= key && key <= range.second; } ),
+               collector.values_ )
+        << range.first << " " << range.second;
+  }
+}
+
+TEST( AdaptiveRadixTree, WideNodesEnumerateByBitmap )
+{
+  // children at bytes c * step under prefix "n" make a Node48 for 17..48 children and a Node256 above.
+  std::vector<std::string> keys;
+  for ( unsigned step : {1u, 3u, 5u, 11u} )
+  {
+    for ( unsigned c = 0; c < 256; c += step )
+    {
+      keys.push_back( std::string( "n" ) + std::to_string( step ) + static_cast<char>( c ) );
+      keys.push_back( std::string( "n" ) + std::to_string( step ) + static_cast<char>( c ) + "x" );
+    }
+  }
+  auto tree = Build( keys );
+  tree->Resize( keys.size() + 1 );
+  auto snapshot = tree->Snapshot();
+  tree->AddEntry( "n11\x01", 4, keys.size() );  //< copies the Node48 of "n11".
+
+  CCollector collector;
+  snapshot->Traverse( collector );
+  ASSERT_EQ( Filter( keys, []( const std::string& ) { return true; } ), collector.values_ );
+
+  for ( auto range : std::vector<std::pair<std::string, std::string>>{
+           {"n1", "n1\x7f"}, {std::string( "n3\0", 3 ), "n3\x01"}, {"n11\xf0", "n11\xff"}, {"n5\x14x", "n5\x1e"}} )
+  {
+    CCollector range_collector;
+    snapshot->TraverseRange( range.first.data(), range.first.size(), range.second.data(), range.second.size(),
+                             range_collector );
+    ASSERT_EQ( Filter( keys, [&]( const std::string& key ) { return range.first <= key && key <= range.second; } ),
+               range_collector.values_ )
+        << range.first << " " << range.second;
+  }
+
+  auto joined = std::make_unique<CAdaptiveRadixTree>( keys.size() );
+  auto part = joined->Split();
+  for ( uint32_t i = 0; i < keys.size(); ++i )
+  {
+    ( i % 2 ? joined : part )->AddEntry( keys[i].c_str(), keys[i].size(), i );
+  }
+  joined->Join( *part );
+  CCollector joined_collector;
+  joined->Traverse( joined_collector );
+  ASSERT_EQ( collector.values_, joined_collector.values_ );
+}
+
+TEST( AdaptiveRadixTree, FreezeSuccinct )
+{
+  std::vector<std::string> keys;
+  std::mt19937 generator( 42 );
+  for ( int i = 0; i < 30000; ++i )
+  {
+    std::string key = WORDS[generator() % WORDS.size()];
+    for ( size_t length = generator() % 12; length; --length )
+    {
+      key.push_back( static_cast<char>( 'a' + generator() % ( i % 3 ? 26 : 3 ) ) );
+    }
+    keys.push_back( key );
+  }
+  auto tree = Build( keys );
+  tree->AddNullString( 0 );
+  auto succinct = tree->FreezeSuccinct();
+
+  ASSERT_GE( succinct->GetDenseLevelCount(), 1u );
+  ASSERT_EQ( tree->GetUniqueStringCount(), succinct->GetUniqueStringCount() );
+  ASSERT_EQ( 1u, succinct->GetNullStringCount() );
+
+  CCollector expected, actual;
+  tree->Traverse( expected );
+  succinct->Traverse( actual );
+  ASSERT_EQ( expected.keys_, actual.keys_ );
+  ASSERT_EQ( expected.values_, actual.values_ );
+
+  for ( size_t i = 0; i < keys.size(); i += 7 )
+  {
+    for ( const std::string& key : {keys[i], keys[i] + "a", keys[i].substr( 0, keys[i].size() / 2 )} )
+    {
+      CIndexIterator begin, end, succinct_begin, succinct_end;
+      bool found = tree->Find( key.data(), key.size(), begin, end );
+      ASSERT_EQ( found, succinct->Find( key.data(), key.size(), succinct_begin, succinct_end ) ) << key;
+      if ( found )
+      {
+        ASSERT_EQ( std::vector<uint32_t>( begin, end ), std::vector<uint32_t>( succinct_begin, succinct_end ) );
+      }
+    }
+  }
+
+  CCollector expected_range, actual_range;
+  tree->TraverseRange( "alib", 4, "b", 1, expected_range );
+  succinct->TraverseRange( "alib", 4, "b", 1, actual_range );
+  ASSERT_FALSE( actual_range.keys_.empty() );
+  ASSERT_EQ( expected_range.values_, actual_range.values_ );
+}
+
+TEST( AdaptiveRadixTree, Scans )
+{
+  auto tree = Build( WORDS );
+  auto succinct = tree->FreezeSuccinct();
+  auto expect = [&]( std::function<bool( const std::string& )> predicate ) {
+    std::vector<uint64_t> bitmap( ( WORDS.size() + 63 ) / 64 );
+    for ( size_t i = 0; i < WORDS.size(); ++i )
+    {
+      bitmap[i / 64] |= static_cast<uint64_t>( predicate( WORDS[i] ) ) << ( i % 64 );
+    }
+    return bitmap;
+  };
+  auto count = []( const std::vector<uint64_t>& bitmap ) {
+    size_t result = 0;
+    for ( uint64_t word : bitmap )
+    {
+      result += detail::Helper::popcount64( word );
+    }
+    return result;
+  };
+
+  std::vector<uint64_t> bitmap( ( WORDS.size() + 63 ) / 64, ~uint64_t( 0 ) ), succinct_bitmap = bitmap;
+  CRowSelection selection( bitmap.data(), WORDS.size() );
+  CRowSelection succinct_selection( succinct_bitmap.data(), WORDS.size() );
+  for ( const std::string prefix : {"", "al", "ali", "alizee", "alizeex", "t", "zzz"} )
+  {
+    auto expected = expect( [&]( const std::string& key ) { return key.compare( 0, prefix.size(), prefix ) == 0; } );
+    ASSERT_EQ( count( expected ), tree->ScanPrefix( prefix.data(), prefix.size(), selection ) ) << prefix;
+    ASSERT_EQ( expected, bitmap ) << prefix;
+    ASSERT_EQ( count( expected ), succinct->ScanPrefix( prefix.data(), prefix.size(), succinct_selection ) );
+    ASSERT_EQ( expected, succinct_bitmap ) << prefix;
+  }
+
+  auto expected = expect( []( const std::string& key ) { return "al" <= key && key <= "b"; } );
+  ASSERT_EQ( count( expected ), tree->ScanRange( "al", 2, "b", 1, selection ) );
+  ASSERT_EQ( expected, bitmap );
+  ASSERT_EQ( count( expected ), succinct->ScanRange( "al", 2, "b", 1, succinct_selection ) );
+  ASSERT_EQ( expected, succinct_bitmap );
+
+  // IN list, one point scan per value.
+  const std::vector<std::string> values = {WORDS[1], WORDS[5], "not a word"};
+  std::vector<uint64_t> in_bitmap( bitmap.size() );
+  CRowSelection in_selection( in_bitmap.data(), WORDS.size(), CRowSelection::Or );
+  for ( const std::string& value : values )
+  {
+    tree->ScanPoint( value.data(), value.size(), in_selection );
+  }
+  ASSERT_EQ( expect( [&]( const std::string& key ) {
+               return std::find( values.begin(), values.end(), key ) != values.end();
+             } ),
+             in_bitmap );
+
+  std::vector<uint32_t> rows = {1234};
+  CRowSelection rows_selection( rows );
+  succinct->ScanPoint( WORDS[5].data(), WORDS[5].size(), rows_selection );
+  std::sort( rows.begin(), rows.end() );
+  ASSERT_EQ( Filter( WORDS, [&]( const std::string& key ) { return key == WORDS[5]; } )[WORDS[5]], rows );
+
+  CAdaptiveRadixTree nulls( 3 );
+  nulls.AddNullString( 0 );
+  nulls.AddEntry( "a", 1, 1 );
+  nulls.AddNullString( 2 );
+  ASSERT_EQ( 2u, nulls.ScanNull( rows_selection ) );
+  std::sort( rows.begin(), rows.end() );
+  ASSERT_EQ( std::vector<uint32_t>( {0, 2} ), rows );
+}
+
+TEST( AdaptiveRadixTree, SplitByRange )
+{
+  std::vector<std::string> keys;
+  std::mt19937 generator( 48 );
+  for ( int i = 0; i < 20000; ++i )
+  {
+    std::string key = i % 5 ? WORDS[generator() % WORDS.size()] : "";
+    for ( size_t length = generator() % 6; length; --length )
+    {
+      key.push_back( static_cast<char>( 'a' + generator() % 4 ) );
+    }
+    keys.push_back( key );
+  }
+
+  for ( size_t k : {1, 2, 7, 64} )
+  {
+    auto tree = Build( keys );
+    tree->AddNullString( 0 );
+    auto snapshot = tree->Snapshot();
+    const auto expected = Collect( *tree );
+    const size_t total_string_length = tree->GetTotalStringLength();
+
+    auto parts = tree->SplitByRange( k );
+    ASSERT_EQ( k, parts.size() );
+    ASSERT_EQ( 0u, tree->GetUniqueStringCount() );
+    ASSERT_TRUE( Collect( *tree ).empty() );
+    ASSERT_EQ( 1u, parts[0]->GetNullStringCount() );
+
+    std::map<std::string, std::vector<uint32_t>> joined;
+    std::string previous_last;
+    size_t unique_string_count = 0, part_string_length = 0;
+    for ( size_t i = 0; i < parts.size(); ++i )
+    {
+      CCollector collector;
+      parts[i]->Traverse( collector );
+      ASSERT_FALSE( collector.keys_.empty() );
+      ASSERT_EQ( collector.keys_.size(), parts[i]->GetUniqueStringCount() - ( i ? 0 : 1 ) );
+      // ranges are disjoint and ordered, and about equally large.
+      if ( i )
+      {
+        ASSERT_LT( previous_last, collector.keys_.front() );
+      }
+      previous_last = collector.keys_.back();
+      ASSERT_LE( collector.keys_.size(), 3 * expected.size() / k + 1 );
+      joined.insert( collector.values_.begin(), collector.values_.end() );
+      unique_string_count += collector.keys_.size();
+      part_string_length += parts[i]->GetTotalStringLength();
+    }
+    ASSERT_EQ( expected, joined );
+    ASSERT_EQ( expected.size(), unique_string_count );
+    ASSERT_EQ( total_string_length, part_string_length );
+    ASSERT_EQ( expected.size(), Collect( *snapshot ).size() );
+  }
+}
+
+TEST( AdaptiveRadixTree, Optimize )
+{
+  std::vector<std::string> keys;
+  for ( int i = 0; i < 20000; ++i )
+  {
+    keys.push_back( WORDS[i % WORDS.size()] + std::to_string( i * 7919 % 3000 ) );
+  }
+
+  CAdaptiveRadixTree tree( keys.size() );
+  for ( size_t begin = 0; begin < keys.size(); begin += 1000 )
+  {
+    auto part = tree.Split();
+    for ( uint32_t i = begin; i < begin + 1000; ++i )
+    {
+      part->AddEntry( keys[i].c_str(), keys[i].size(), i );
+    }
+    tree.Join( *part );
+  }
+  auto expected = Filter( keys, []( const std::string& ) { return true; } );
+  auto snapshot = tree.Snapshot();
+
+  tree.Optimize();
+  ASSERT_NE( nullptr, tree.GetNodePool() );
+  ASSERT_EQ( expected, Collect( tree ) );
+  ASSERT_EQ( expected.size(), tree.GetUniqueStringCount() );
+  ASSERT_EQ( expected, Collect( *snapshot ) );
+
+  tree.AddEntry( "alibab", 6, 0 );
+  expected["alibab"].push_back( 0 );
+  ASSERT_EQ( expected, Collect( tree ) );
+}
+
+TEST( AdaptiveRadixTree, TraverseParallel )
+{
+  std::vector<std::string> keys;
+  for ( int i = 0; i < 20000; ++i )
+  {
+    keys.push_back( std::to_string( i * 7919 % 4000 ) + WORDS[i % WORDS.size()] );
+  }
+  auto tree = Build( keys );
+
+  struct CNodeCountingCollector : CCollector
+  {
+    void HandleNode( CArtNode const*, std::string const&, uint32_t ) override
+    {
+      ++node_count_;
+    }
+    size_t node_count_ = 0;
+  };
+  CNodeCountingCollector expected;
+  tree->Traverse( expected );
+
+  auto factory = [] { return std::unique_ptr<CActionBase>( new CNodeCountingCollector ); };
+  for ( bool ordered : {false, true} )
+  {
+    std::vector<std::string> keys_in_order;
+    std::map<std::string, std::vector<uint32_t>> values;
+    size_t node_count = 0;
+    for ( auto& action : tree->TraverseParallel( factory, 4, ordered ) )
+    {
+      auto& collector = static_cast<CNodeCountingCollector&>( *action );
+      keys_in_order.insert( keys_in_order.end(), collector.keys_.begin(), collector.keys_.end() );
+      values.insert( collector.values_.begin(), collector.values_.end() );
+      node_count += collector.node_count_;
+    }
+
+    ASSERT_EQ( expected.values_, values );
+    ASSERT_EQ( expected.node_count_, node_count );
+    if ( ordered )
+    {
+      ASSERT_EQ( expected.keys_, keys_in_order );
+    }
+  }
+}
+
+TEST( AdaptiveRadixTree, Mismatch )
+{
+  std::string left( 100, 'a' );
+  for ( size_t length = 0; length <= left.size(); ++length )
+  {
+    ASSERT_EQ( length, detail::Helper::Mismatch( left.data(), left.data(), length ) );
+    for ( size_t position = 0; position < length; ++position )
+    {
+      std::string right = left;
+      right[position] = '\x80';
+      ASSERT_EQ( position, detail::Helper::Mismatch( left.data(), right.data(), length ) );
+      ASSERT_EQ( position, detail::Helper::Mismatch( right.data(), left.data(), length ) );
+    }
+  }
+}
+
+TEST( AdaptiveRadixTree, DeleteAndUpdateRows )
+{
+  std::vector<std::string> keys;
+  for ( int i = 0; i < 5000; ++i )
+  {
+    keys.push_back( i % 17 ? WORDS[i % WORDS.size()] + std::to_string( i % 50 ) : "" );
+  }
+
+  CAdaptiveRadixTree tree( keys.size() );
+  for ( uint32_t i = 0; i < 2500; ++i )
+  {
+    keys[i].empty() ? tree.AddNullString( i ) : tree.AddEntry( keys[i].c_str(), keys[i].size(), i );
+  }
+  // tracking is built from existing rows and maintained for new ones, including node growths.
+  tree.EnableRowTracking();
+  for ( uint32_t i = 2500; i < keys.size(); ++i )
+  {
+    keys[i].empty() ? tree.AddNullString( i ) : tree.AddEntry( keys[i].c_str(), keys[i].size(), i );
+  }
+
+  std::vector<bool> present( keys.size(), true );
+  std::mt19937 generator( 7 );
+  for ( int step = 0; step < 6000; ++step )
+  {
+    uint32_t row = generator() % keys.size();
+    if ( generator() % 3 )
+    {
+      ASSERT_EQ( static_cast<bool>( present[row] ), tree.DeleteRow( row ) );
+      present[row] = false;
+      continue;
+    }
+    keys[row] = WORDS[generator() % WORDS.size()] + std::to_string( generator() % 70 ) + "x";
+    present[row] = true;
+    tree.UpdateRow( row, keys[row].c_str(), keys[row].size() );
+  }
+  ASSERT_FALSE( tree.DeleteRow( keys.size() ) );
+
+  std::map<std::string, std::vector<uint32_t>> expected;
+  std::vector<uint32_t> nulls;
+  size_t total_length = 0;
+  for ( uint32_t i = 0; i < keys.size(); ++i )
+  {
+    if ( present[i] )
+    {
+      ( keys[i].empty() ? nulls : expected[keys[i]] ).push_back( i );
+      total_length += keys[i].size();
+    }
+  }
+  ASSERT_EQ( expected, Collect( tree ) );
+  ASSERT_EQ( expected.size() + ( nulls.empty() ? 0 : 1 ), tree.GetUniqueStringCount() );
+  ASSERT_EQ( total_length, tree.GetTotalStringLength() );
+  ASSERT_EQ( nulls.size(), tree.GetNullStringCount() );
+  std::vector<uint32_t> null_rows( tree.GetNullStringBegin(), tree.GetNullStringEnd() );
+  std::sort( null_rows.begin(), null_rows.end() );
+  ASSERT_EQ( nulls, null_rows );
+
+  // Optimize drops nodes of keys which lost all their rows, and tracking still works on the copy.
+  const size_t node_count = tree.FreezeSuccinct()->GetNodeCount();
+  tree.Optimize();
+  ASSERT_EQ( expected, Collect( tree ) );
+  ASSERT_LT( tree.FreezeSuccinct()->GetNodeCount(), node_count );
+  for ( uint32_t i = 0; i < keys.size(); ++i )
+  {
+    ASSERT_EQ( static_cast<bool>( present[i] ), tree.DeleteRow( i ) );
+  }
+  tree.Optimize();
+  ASSERT_TRUE( Collect( tree ).empty() );
+  ASSERT_EQ( CAdaptiveRadixTree( keys.size() ).FreezeSuccinct()->GetNodeCount(),
+             tree.FreezeSuccinct()->GetNodeCount() );
+}
+
+TEST( AdaptiveRadixTree, MemoryPolicies )
+{
+  std::vector<std::string> keys;
+  for ( int i = 0; i < 20000; ++i )
+  {
+    keys.push_back( WORDS[i % WORDS.size()] + std::to_string( i * 7919 % 5000 ) );
+  }
+  auto expected = Filter( keys, []( const std::string& ) { return true; } );
+
+  for ( auto policy : {CArtMemoryPolicy(),
+                       CArtMemoryPolicy( CArtMemoryPolicy::TransparentHugePages, CArtMemoryPolicy::LocalPlacement ),
+                       CArtMemoryPolicy( CArtMemoryPolicy::ExplicitHugePages, CArtMemoryPolicy::InterleavedPlacement )} )
+  {
+    std::shared_ptr<const CAdaptiveRadixTree> snapshot;
+    {
+      CAdaptiveRadixTree tree( keys.size(), policy );
+      auto part = tree.Split();
+      ASSERT_NE( nullptr, part->GetNodePool() );
+      for ( uint32_t i = 0; i < keys.size(); ++i )
+      {
+        ( i % 2 ? *part : tree ).AddEntry( keys[i].c_str(), keys[i].size(), i );
+      }
+      ASSERT_GE( tree.GetNodePool()->GetChunkCount(), 1u );
+
+      // nodes of joined tree stay in its pool and must outlive it.
+      tree.Join( *part );
+      part.reset();
+      snapshot = tree.Snapshot();
+      tree.AddEntry( "new", 3, 0 );
+    }
+    ASSERT_EQ( expected, Collect( *snapshot ) );
+  }
+}
+
+TEST( AdaptiveRadixTree, SmallTreesSharingArena )
+{
+  auto arena = std::make_shared<CArtArena>();
+  std::vector<std::unique_ptr<CAdaptiveRadixTree>> trees;
+  std::vector<std::vector<std::string>> partitions;
+  for ( size_t p = 0; p < 200; ++p )
+  {
+    std::vector<std::string> keys;
+    for ( size_t i = 0; i < p % 7; ++i )
+    {
+      keys.push_back( WORDS[( p + i * 3 ) % WORDS.size()] );
+    }
+    auto tree = std::make_unique<CAdaptiveRadixTree>( keys.size(), p % 2 ? arena : nullptr );
+    for ( uint32_t i = 0; i < keys.size(); ++i )
+    {
+      tree->AddEntry( keys[i].c_str(), keys[i].size(), i );
+    }
+    partitions.push_back( keys );
+    trees.push_back( std::move( tree ) );
+  }
+
+  ASSERT_EQ( arena->node_pool_.get(), trees[1]->GetNodePool() );
+  ASSERT_EQ( nullptr, trees[0]->GetNodePool() );
+  for ( size_t p = 0; p < trees.size(); ++p )
+  {
+    ASSERT_EQ( Collect( *Build( partitions[p] ) ), Collect( *trees[p] ) );
+  }
+
+  // joining trees of the same arena doesn't copy prefixes.
+  size_t suffix_size = arena->suffix_table_->size();
+  auto joined = std::make_unique<CAdaptiveRadixTree>( 10, arena );
+  auto part = joined->Split();
+  // split trees may be filled concurrently, so they don't allocate from the arena's pool.
+  ASSERT_NE( nullptr, part->GetNodePool() );
+  ASSERT_NE( joined->GetNodePool(), part->GetNodePool() );
+  joined->AddEntry( "alize", 5, 0 );
+  joined->AddEntry( "tools", 5, 1 );
+  part->AddEntry( "alt", 3, 2 );
+  part->AddEntry( "terror", 6, 3 );
+  joined->Join( *part );
+  ASSERT_EQ( ( std::map<std::string, std::vector<uint32_t>>{
+                 {"alize", {0}}, {"alt", {2}}, {"terror", {3}}, {"tools", {1}}} ),
+             Collect( *joined ) );
+
+  trees[5]->Reset();
+  ASSERT_TRUE( Collect( *trees[5] ).empty() );
+  ASSERT_LE( suffix_size, arena->suffix_table_->size() );
+  trees[5]->AddEntry( "b", 1, 0 );
+  ASSERT_EQ( 1u, Collect( *trees[5] ).size() );
+  ASSERT_EQ( Collect( *Build( partitions[7] ) ), Collect( *trees[7] ) );
+}
+
+TEST( AdaptiveRadixTree, BufferedConcurrentInsertions )
+{
+  const uint32_t row_count = 40000;
+  const unsigned thread_count = 4;
+  CBufferedAdaptiveRadixTree tree( row_count, 1000 );
+
+  std::vector<std::string> keys( row_count );
+  for ( uint32_t i = 0; i < row_count; ++i )
+  {
+    keys[i] = i % 31 ? WORDS[i % WORDS.size()] + std::to_string( i % 113 ) : "";
+  }
+
+  std::vector<std::thread> threads;
+  for ( unsigned t = 0; t < thread_count; ++t )
+  {
+    threads.emplace_back( [&, t]() {
+      for ( uint32_t i = t; i < row_count; i += thread_count )
+      {
+        if ( keys[i].empty() )
+        {
+          tree.AddNullString( i );
+        }
+        else
+        {
+          tree.AddEntry( keys[i].data(), keys[i].size(), i );
+        }
+      }
+    } );
+  }
+
+  // reads run concurrently with insertions and merges; rows of a key only grow.
+  size_t previous_count = 0;
+  std::vector<uint32_t> rows;
+  CRowSelection selection( rows );
+  for ( int i = 0; i < 200; ++i )
+  {
+    size_t count = tree.ScanPrefix( WORDS[1].data(), WORDS[1].size(), selection );
+    ASSERT_EQ( count, rows.size() );
+    ASSERT_GE( count, previous_count );
+    previous_count = count;
+  }
+  for ( auto& thread : threads )
+  {
+    thread.join();
+  }
+
+  auto expected = Filter( keys, []( const std::string& key ) { return !key.empty(); } );
+  std::vector<uint64_t> bitmap( ( row_count + 63 ) / 64 );
+  CRowSelection bitmap_selection( bitmap.data(), row_count );
+  ASSERT_EQ( expected[keys[5]].size(), tree.ScanPoint( keys[5].data(), keys[5].size(), bitmap_selection ) );
+  for ( uint32_t row : expected[keys[5]] )
+  {
+    ASSERT_TRUE( bitmap[row / 64] >> ( row % 64 ) & 1 );
+  }
+  ASSERT_EQ( ( row_count + 30 ) / 31, tree.ScanNull( selection ) );
+
+  tree.Flush();
+  ASSERT_GE( tree.GetMergeCount(), 1u );
+  auto main = tree.Release();
+  ASSERT_EQ( expected, Collect( *main ) );
+  ASSERT_EQ( ( row_count + 30 ) / 31, main->GetNullStringCount() );
+}
+
+TEST( AdaptiveRadixTree, ShardedConcurrentInsertions )
+{
+  std::vector<std::string> keys;
+  for ( int i = 0; i < 8000; ++i )
+  {
+    keys.push_back( i % 13 ? std::to_string( i * 7919 % 1000 ) + WORDS[i % WORDS.size()] : "" );
+  }
+
+  // keys start with digits only, so shard boundaries are placed between them.
+  CShardedAdaptiveRadixTree tree( keys.size(), std::vector<uint8_t>{'3', '6'} );
+  ASSERT_EQ( 3u, tree.GetShardCount() );
+
+  const unsigned threads = 4;
+  std::vector<std::thread> workers;
+  for ( unsigned t = 0; t < threads; ++t )
+  {
+    workers.emplace_back( [&, t] {
+      for ( uint32_t i = t; i < keys.size(); i += threads )
+      {
+        if ( keys[i].empty() )
+        {
+          tree.AddNullString( i );
+        }
+        else
+        {
+          tree.AddEntry( keys[i].c_str(), keys[i].size(), i );
+        }
+      }
+    } );
+  }
+  for ( auto& worker : workers )
+  {
+    worker.join();
+  }
+
+  auto expected = Filter( keys, []( const std::string& key ) { return !key.empty(); } );
+  CCollector collector;
+  tree.Traverse( collector );
+  ASSERT_EQ( expected, collector.values_ );
+  ASSERT_TRUE( std::is_sorted( collector.keys_.begin(), collector.keys_.end() ) );
+  ASSERT_EQ( expected.size() + 1, tree.GetUniqueStringCount() );
+  ASSERT_EQ( 616u, tree.GetNullStringCount() );
+
+  CIndexIterator begin, end;
+  ASSERT_TRUE( tree.Find( keys[1].c_str(), keys[1].size(), begin, end ) );
+  std::vector<uint32_t> rows( begin, end );
+  std::sort( rows.begin(), rows.end() );
+  ASSERT_EQ( expected[keys[1]], rows );
+  ASSERT_FALSE( tree.Find( "999x", 4, begin, end ) );
+
+  auto single = tree.Release();
+  ASSERT_EQ( expected, Collect( *single ) );
+}
+
 INSTANTIATE_TEST_CASE_P( ConstructARTWithRandomStringsInstantiation, ConstructARTWithRandomStrings,
                          ::testing::Values<TestParam>( TestParam{0xDEADBEEF, 1000000, 5, 1000},
                                                        TestParam{std::random_device()(), 100000, 50, 100} ) );
@@ -0,0 +1,71 @@
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <iostream>
+#include <string>
+
+#include "adaptive_radix_tree_loader.hpp"
+
+// Builds an ART from a file of delimiter separated records and prints its statistics.
+// usage: artload <file> [delimiter] [threads]
+// delimiter is a single character, or one of \n, \t and \0; it defaults to new line.
+int main( int argc, char** argv )
+{
+  if ( argc < 2 || argc > 4 )
+  {
+    std::cerr << "usage: " << argv[0] << " <file> [delimiter] [threads]" << std::endl;
+    return 1;
+  }
+
+  char delimiter = '\n';
+  if ( argc > 2 )
+  {
+    std::string argument = argv[2];
+    if ( argument == "\\n" )
+    {
+      delimiter = '\n';
+    }
+    else if ( argument == "\\t" )
+    {
+      delimiter = '\t';
+    }
+    else if ( argument == "\\0" )
+    {
+      delimiter = '\0';
+    }
+    else if ( argument.size() == 1 )
+    {
+      delimiter = argument[0];
+    }
+    else
+    {
+      std::cerr << "delimiter has to be a single character: " << argument << std::endl;
+      return 1;
+    }
+  }
+
+  unsigned threads = argc > 3 ? static_cast<unsigned>( std::strtoul( argv[3], nullptr, 10 ) ) : 1;
+
+  try
+  {
+    auto start = std::chrono::steady_clock::now();
+    CArtFileLoader loader( argv[1] );
+    auto tree = loader.Build( delimiter, threads );
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    std::cout << "file size:           " << loader.size() << std::endl;
+    std::cout << "records:             " << tree->GetIndexVectorLength() << std::endl;
+    std::cout << "null records:        " << tree->GetNullStringCount() << std::endl;
+    std::cout << "unique strings:      " << tree->GetUniqueStringCount() << std::endl;
+    std::cout << "total string length: " << tree->GetTotalStringLength() << std::endl;
+    std::cout << "max string length:   " << tree->GetMaxStringLength() << std::endl;
+    std::cout << "build time (s):      " << elapsed.count() << std::endl;
+  }
+  catch ( const std::exception& e )
+  {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}
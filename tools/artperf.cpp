@@ -0,0 +1,333 @@
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "adaptive_radix_tree.hpp"
+#include "utils.hpp"
+
+namespace
+{
+const size_t DEFAULT_KEY_COUNT = 1000000;
+
+struct CEvent
+{
+  const char* name_;
+  uint32_t type_;
+  uint64_t config_;
+};
+
+uint64_t CacheMiss( uint64_t cache )
+{
+  return cache | ( PERF_COUNT_HW_CACHE_OP_READ << 8 ) | ( PERF_COUNT_HW_CACHE_RESULT_MISS << 16 );
+}
+
+const CEvent EVENTS[] = {
+    {"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {"L1d misses", PERF_TYPE_HW_CACHE, CacheMiss( PERF_COUNT_HW_CACHE_L1D )},
+    {"LLC misses", PERF_TYPE_HW_CACHE, CacheMiss( PERF_COUNT_HW_CACHE_LL )},
+    {"dTLB misses", PERF_TYPE_HW_CACHE, CacheMiss( PERF_COUNT_HW_CACHE_DTLB )},
+    {"branch misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+};
+const size_t EVENT_COUNT = sizeof( EVENTS ) / sizeof( EVENTS[0] );
+const size_t GROUP_SIZE = 2;  //< cycles and instructions, first in EVENTS.
+
+/// Hardware counters of the calling thread. Cycles and instructions are opened as one group, so they are
+/// scheduled together and IPC is computed from the same window even when counters are multiplexed; the other
+/// events are opened on their own, so that an event the CPU or kernel doesn't offer only loses its own column.
+/// Counters are multiplexed if there are more than the PMU has, so values are scaled by the share of time they
+/// were running.
+class CPerfCounters
+{
+public:
+  CPerfCounters()
+  {
+    for ( size_t i = 0; i < EVENT_COUNT; ++i )
+    {
+      // cycles lead the group; instructions fall back to counting on their own if they can't join it.
+      const bool member = i > 0 && i < GROUP_SIZE && fds_[0] >= 0;
+      fds_[i] = Open( EVENTS[i], i == 0 || member, member ? fds_[0] : -1 );
+      if ( member && fds_[i] >= 0 )
+      {
+        grouped_ = true;
+      }
+      else if ( member )
+      {
+        fds_[i] = Open( EVENTS[i], false, -1 );
+      }
+      if ( fds_[i] < 0 && !error_ )
+      {
+        error_ = errno;
+      }
+    }
+  }
+
+  ~CPerfCounters()
+  {
+    for ( int fd : fds_ )
+    {
+      if ( fd >= 0 )
+      {
+        close( fd );
+      }
+    }
+  }
+
+  CPerfCounters( const CPerfCounters& ) = delete;
+  CPerfCounters& operator=( const CPerfCounters& ) = delete;
+
+  /// errno of the first event which couldn't be opened, 0 if all were.
+  int GetError() const
+  {
+    return error_;
+  }
+
+  void Start()
+  {
+    Control( PERF_EVENT_IOC_RESET );
+    Control( PERF_EVENT_IOC_ENABLE );
+  }
+
+  void Stop()
+  {
+    Control( PERF_EVENT_IOC_DISABLE );
+  }
+
+  /// Scaled value of event since Start, or -1 if it isn't available or never ran.
+  double Read( size_t event ) const
+  {
+    if ( fds_[event] < 0 )
+    {
+      return -1;
+    }
+    if ( event == 0 || ( event < GROUP_SIZE && grouped_ ) )
+    {
+      // one read returns the whole group: count, time enabled, time running, then a value per member.
+      const size_t members = grouped_ ? GROUP_SIZE : 1;
+      const ssize_t size = static_cast<ssize_t>( ( 3 + members ) * sizeof( uint64_t ) );
+      uint64_t values[3 + GROUP_SIZE];
+      if ( read( fds_[0], values, size ) != size || values[0] != members || !values[2] )
+      {
+        return -1;
+      }
+      return static_cast<double>( values[3 + event] ) * values[1] / values[2];
+    }
+    uint64_t values[3];  //< value, time enabled, time running.
+    if ( read( fds_[event], values, sizeof( values ) ) != sizeof( values ) || !values[2] )
+    {
+      return -1;
+    }
+    return static_cast<double>( values[0] ) * values[1] / values[2];
+  }
+
+private:
+  /// Opens event of the calling thread disabled, in the group of group_fd unless it is -1.
+  static int Open( const CEvent & event, bool group_format, int group_fd )
+  {
+    perf_event_attr attr;
+    memset( &attr, 0, sizeof( attr ) );
+    attr.size = sizeof( attr );
+    attr.type = event.type_;
+    attr.config = event.config_;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;  //< allowed with perf_event_paranoid up to 2.
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    if ( group_format )
+    {
+      attr.read_format |= PERF_FORMAT_GROUP;
+    }
+    return static_cast<int>( syscall( SYS_perf_event_open, &attr, 0, -1, group_fd, 0 ) );
+  }
+
+  /// Applies ioctl request to all counters, to group members through their leader.
+  void Control( unsigned long request )
+  {
+    for ( size_t i = 0; i < EVENT_COUNT; ++i )
+    {
+      if ( fds_[i] < 0 || ( grouped_ && i > 0 && i < GROUP_SIZE ) )
+      {
+        continue;
+      }
+      ioctl( fds_[i], request, i == 0 && grouped_ ? PERF_IOC_FLAG_GROUP : 0 );
+    }
+  }
+
+  int fds_[EVENT_COUNT];
+  int error_ = 0;
+  bool grouped_ = false;  //< instructions are counted in the group of cycles.
+};
+
+/// Runs phase with counters enabled and prints its time and counters in total and per key.
+void Measure( CPerfCounters & counters, const char* phase, size_t key_count, const std::function<void()> & function )
+{
+  auto start = std::chrono::steady_clock::now();
+  counters.Start();
+  function();
+  counters.Stop();
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+  const double per_key = key_count ? 1.0 / key_count : 0;
+  std::cout << phase << " (" << key_count << " keys)" << std::endl;
+  std::cout << "  " << std::left << std::setw( 16 ) << "time (s)" << std::right << std::setprecision( 6 )
+            << std::setw( 16 ) << elapsed.count() << std::setw( 16 ) << elapsed.count() * 1e9 * per_key << " ns/key"
+            << std::endl;
+  for ( size_t i = 0; i < EVENT_COUNT; ++i )
+  {
+    std::cout << "  " << std::left << std::setw( 16 ) << EVENTS[i].name_ << std::right;
+    const double value = counters.Read( i );
+    if ( value < 0 )
+    {
+      std::cout << std::setw( 16 ) << "n/a" << std::endl;
+      continue;
+    }
+    std::cout << std::setw( 16 ) << std::fixed << std::setprecision( 0 ) << value << std::setw( 16 )
+              << std::setprecision( 3 ) << value * per_key << " /key" << std::defaultfloat << std::endl;
+  }
+  const double cycles = counters.Read( 0 ), instructions = counters.Read( 1 );
+  if ( cycles > 0 && instructions >= 0 )
+  {
+    std::cout << "  " << std::left << std::setw( 16 ) << "IPC" << std::right << std::setw( 16 )
+              << std::setprecision( 3 ) << instructions / cycles << std::endl;
+  }
+}
+
+std::vector<std::string> RandomKeys( size_t count )
+{
+  // url-like keys with shared prefixes, so that inner nodes of all sizes occur.
+  std::mt19937 generator( 42 );
+  std::vector<std::string> keys;
+  keys.reserve( count );
+  for ( size_t i = 0; i < count; ++i )
+  {
+    std::string key = "www.";
+    key.push_back( static_cast<char>( 'a' + generator() % 26 ) );
+    key += std::to_string( generator() % 1000 ) + ".com/";
+    for ( size_t length = 2 + generator() % 14; length; --length )
+    {
+      key.push_back( static_cast<char>( 32 + generator() % 95 ) );
+    }
+    keys.push_back( key );
+  }
+  return keys;
+}
+
+std::vector<std::string> FileKeys( const char* path )
+{
+  std::ifstream file( path );
+  if ( !file )
+  {
+    throw std::runtime_error( std::string( "can't open " ) + path + ": " + strerror( errno ) );
+  }
+  std::vector<std::string> keys;
+  for ( std::string line; std::getline( file, line ); )
+  {
+    keys.push_back( line );
+  }
+  return keys;
+}
+}
+
+// Profiles build, lookup, traverse and join of an ART with hardware performance counters.
+// usage: artperf [key count | file]
+// Keys are generated, or read one per line from file. Counters the kernel doesn't allow (see
+// /proc/sys/kernel/perf_event_paranoid) or the CPU doesn't have are reported as n/a, times are always reported.
+int main( int argc, char** argv )
+{
+  if ( argc > 2 )
+  {
+    std::cerr << "usage: " << argv[0] << " [key count | file]" << std::endl;
+    return 1;
+  }
+
+  try
+  {
+    std::vector<std::string> keys;
+    char* end = nullptr;
+    const size_t key_count = argc > 1 ? std::strtoull( argv[1], &end, 10 ) : DEFAULT_KEY_COUNT;
+    if ( argc > 1 && *end )
+    {
+      keys = FileKeys( argv[1] );
+    }
+    else
+    {
+      keys = RandomKeys( key_count );
+    }
+
+    CPerfCounters counters;
+    if ( counters.GetError() )
+    {
+      std::cerr << "some hardware counters are unavailable: " << strerror( counters.GetError() ) << std::endl;
+    }
+
+    const uint32_t row_count = static_cast<uint32_t>( keys.size() );
+    auto tree = std::make_unique<CAdaptiveRadixTree>( row_count );
+    Measure( counters, "build", keys.size(), [&]() {
+      for ( uint32_t i = 0; i < row_count; ++i )
+      {
+        tree->AddEntry( keys[i].data(), keys[i].size(), i );
+      }
+    } );
+
+    // lookups in random order, as an index serves them.
+    std::vector<uint32_t> order( row_count );
+    for ( uint32_t i = 0; i < row_count; ++i )
+    {
+      order[i] = i;
+    }
+    std::shuffle( order.begin(), order.end(), std::mt19937( 7 ) );
+    size_t found = 0;
+    Measure( counters, "lookup", keys.size(), [&]() {
+      CIndexIterator begin, end;
+      for ( uint32_t i : order )
+      {
+        found += tree->Find( keys[i].data(), keys[i].size(), begin, end );
+      }
+    } );
+
+    size_t traversed = 0;
+    Measure( counters, "traverse", tree->GetUniqueStringCount(), [&]() {
+      tree->ForEachKey( [&]( const char*, size_t key_length, CIndexIterator, CIndexIterator ) {
+        traversed += key_length;
+      } );
+    } );
+
+    // every other key goes to a second tree, which is then joined into the first.
+    auto left = std::make_unique<CAdaptiveRadixTree>( row_count );
+    auto right = left->Split();
+    for ( uint32_t i = 0; i < row_count; ++i )
+    {
+      ( i % 2 ? right : left )->AddEntry( keys[i].data(), keys[i].size(), i );
+    }
+    const size_t right_count = right->GetUniqueStringCount();
+    Measure( counters, "join", right_count, [&]() { left->Join( *right ); } );
+
+    if ( found != keys.size() || left->GetUniqueStringCount() != tree->GetUniqueStringCount() || !traversed )
+    {
+      std::cerr << "unexpected result: " << found << " of " << keys.size() << " keys found" << std::endl;
+      return 1;
+    }
+  }
+  catch ( const std::exception& e )
+  {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}